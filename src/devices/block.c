@@ -1,10 +1,40 @@
 #include "devices/block.h"
 #include <list.h>
+#include <rdtsc.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 
+/* Number of buckets in a latency histogram.  Bucket I counts
+   requests that took 2**I to 2**(I+1) - 1 CPU cycles; the last
+   bucket also counts anything slower. */
+#define LATENCY_BUCKETS 40
+
+/* Block device statistics, reset by block_reset_stats(). */
+struct block_stats
+  {
+    unsigned long long read_cnt;        /* Number of sectors read. */
+    unsigned long long write_cnt;       /* Number of sectors written. */
+
+    unsigned long long transfer_cnt;    /* Number of I/Os started. */
+    unsigned long long seek_total;      /* Sum of sector deltas between
+                                           consecutive I/Os. */
+    unsigned long long sequential_cnt;  /* I/Os that began right after
+                                           the previous one. */
+
+    unsigned peak_queue_depth;          /* Maximum queue_depth. */
+    unsigned long long request_cnt;     /* Number of requests. */
+    unsigned long long depth_total;     /* Sum of queue_depth seen by
+                                           each request. */
+    unsigned long long merge_cnt;       /* Requests merged by driver. */
+
+    /* Time from submission to completion of each request. */
+    unsigned long long latency[LATENCY_BUCKETS];
+  };
+
 /* A block device. */
 struct block
   {
@@ -17,8 +47,13 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct block_stats stats;           /* Statistics. */
+    block_sector_t last_sector;         /* Last sector of the previous I/O. */
+    unsigned queue_depth;               /* Requests submitted but not
+                                           yet completed. */
+
+    block_write_hook_func *write_hook;  /* Called before each write. */
+    void *write_hook_aux;               /* Passed to WRITE_HOOK. */
   };
 
 /* List of all block devices. */
@@ -28,6 +63,10 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void count_request (struct block *);
+static void record_seek (struct block *, block_sector_t, size_t cnt);
+static void record_latency (struct block *, uint64_t cycles);
+static void start_request (struct block *, struct block_request *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,6 +152,18 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are all
+   within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
+{
+  check_sector (block, sector);
+  if (cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%zu, "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt,
+           block->size);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +171,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +182,116 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFER, which must have room for
+   CNT * BLOCK_SECTOR_SIZE bytes.  If the driver supports it, the
+   transfer is done with as few device commands as possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     size_t cnt, void *buffer)
+{
+  struct block_request req;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&req, false, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &req);
+  block_request_wait (&req);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.  If the driver supports it, the transfer is done
+   with as few device commands as possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  struct block_request req;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&req, true, sector, cnt, (void *) buffer, NULL, NULL);
+  block_submit (block, &req);
+  block_request_wait (&req);
+}
+
+/* Initializes REQ as a request to read (or, if WRITE is true,
+   write) the CNT sectors starting at SECTOR into (or from)
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  When the request completes, DONE, if nonnull, will be
+   called with REQ as argument; DONE may use AUX as it likes. */
+void
+block_request_init (struct block_request *req, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    block_request_func *done, void *aux)
+{
+  ASSERT (req != NULL);
+  ASSERT (cnt > 0);
+
+  req->write = write;
+  req->sector = sector;
+  req->cnt = cnt;
+  req->buffer = buffer;
+  req->done = done;
+  req->aux = aux;
+}
+
+/* Submits REQ, which must have been initialized with
+   block_request_init(), to BLOCK.  Returns as soon as the
+   request is queued, which may be before or after it
+   completes; use block_request_poll() or block_request_wait(),
+   or REQ's callback, to find out when it has.  Requests to
+   different channels, or to drivers that queue them, proceed in
+   parallel. */
+void
+block_submit (struct block *block, struct block_request *req)
+{
+  enum intr_level old_level;
+
+  if (req->write && block->write_hook != NULL)
+    {
+      ASSERT (!intr_context ());
+      block->write_hook (block->write_hook_aux, req->sector, req->cnt);
+    }
+
+  old_level = intr_disable ();
+  count_request (block);
+  intr_set_level (old_level);
+
+  req->block = block;
+  req->dev = block;
+  req->start_time = timer_ticks ();
+  req->start_cycles = rdtsc ();
+  req->dev_sector = req->sector;
+  req->driver = NULL;
+  req->complete = false;
+  sema_init (&req->complete_sema, 0);
+  start_request (block, req);
+}
+
+/* Returns true if REQ has completed, false if it is still in
+   progress. */
+bool
+block_request_poll (const struct block_request *req)
+{
+  return req->complete;
+}
+
+/* Waits for REQ to complete.  May be called only once per
+   submission of REQ. */
+void
+block_request_wait (struct block_request *req)
+{
+  sema_down (&req->complete_sema);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +315,45 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Prints BLOCK's statistics. */
+static void
+print_stats (struct block *block)
+{
+  const struct block_stats *st = &block->stats;
+  const char *name = block->name;
+  const char *type = block_type_name (block->type);
+  unsigned long long seek_cnt = (st->transfer_cnt > 0
+                                 ? st->transfer_cnt - 1
+                                 : 0);
+  unsigned long long depth = (st->request_cnt > 0
+                              ? st->depth_total * 100 / st->request_cnt
+                              : 0);
+  int i;
+
+  printf ("%s (%s): %llu reads, %llu writes, "
+          "%llu sectors average seek\n",
+          name, type, st->read_cnt, st->write_cnt,
+          seek_cnt > 0 ? st->seek_total / seek_cnt : 0);
+  printf ("%s (%s): %llu requests, queue depth %llu.%02llu average, "
+          "%u peak, %llu merges\n",
+          name, type, st->request_cnt, depth / 100, depth % 100,
+          st->peak_queue_depth, st->merge_cnt);
+  printf ("%s (%s): %llu bytes read, %llu bytes written, "
+          "%llu%% sequential\n",
+          name, type, st->read_cnt * BLOCK_SECTOR_SIZE,
+          st->write_cnt * BLOCK_SECTOR_SIZE,
+          seek_cnt > 0 ? st->sequential_cnt * 100 / seek_cnt : 0);
+
+  if (st->request_cnt > 0)
+    {
+      printf ("%s (%s): latency in cycles:", name, type);
+      for (i = 0; i < LATENCY_BUCKETS; i++)
+        if (st->latency[i] != 0)
+          printf (" 2^%d:%llu", i, st->latency[i]);
+      printf ("\n");
+    }
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -167,15 +361,51 @@ block_print_stats (void)
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
+    if (block_by_role[i] != NULL)
+      print_stats (block_by_role[i]);
+}
+
+/* Prints statistics for every block device that has been used
+   since the last reset, whether or not it has a role. */
+void
+block_print_all_stats (void)
+{
+  struct block *block;
+
+  for (block = block_first (); block != NULL; block = block_next (block))
+    if (block->stats.request_cnt > 0)
+      print_stats (block);
+}
+
+/* Resets the statistics of every block device, so that they
+   describe only I/O from now on.  Requests in progress still
+   count toward the queue depth. */
+void
+block_reset_stats (void)
+{
+  struct block *block;
+  enum intr_level old_level = intr_disable ();
+
+  for (block = block_first (); block != NULL; block = block_next (block))
     {
-      struct block *block = block_by_role[i];
-      if (block != NULL)
-        {
-          printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
-        }
+      memset (&block->stats, 0, sizeof block->stats);
+      block->stats.peak_queue_depth = block->queue_depth;
     }
+  intr_set_level (old_level);
+}
+
+/* Returns the number of sectors read from BLOCK so far. */
+unsigned long long
+block_read_cnt (struct block *block)
+{
+  return block->stats.read_cnt;
+}
+
+/* Returns the number of sectors written to BLOCK so far. */
+unsigned long long
+block_write_cnt (struct block *block)
+{
+  return block->stats.write_cnt;
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -198,8 +428,11 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+  block->last_sector = 0;
+  block->queue_depth = 0;
+  block->write_hook = NULL;
+  block->write_hook_aux = NULL;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +444,162 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Arranges for HOOK to be called with AUX and the range of
+   sectors about to be written each time a write is submitted to
+   BLOCK, before the write starts.  HOOK runs in the submitting
+   thread and may sleep.  Writes that reach BLOCK's sectors
+   through another device, e.g. the disk that contains a
+   partition, do not call HOOK.  A null HOOK removes the hook. */
+void
+block_set_write_hook (struct block *block, block_write_hook_func *hook,
+                      void *aux)
+{
+  enum intr_level old_level = intr_disable ();
+  block->write_hook = hook;
+  block->write_hook_aux = aux;
+  intr_set_level (old_level);
+}
+
+/* Passes REQ, which was submitted to a block device stacked on
+   top of BLOCK, down to BLOCK.  The stacked device's driver must
+   first have translated REQ's dev_sector to a sector on BLOCK.
+   From here on, REQ counts toward the queue depth of BLOCK as
+   well as of the device it was submitted to, but no longer of
+   any device in between. */
+void
+block_forward (struct block *block, struct block_request *req)
+{
+  enum intr_level old_level = intr_disable ();
+  if (req->dev != req->block)
+    req->dev->queue_depth--;
+  count_request (block);
+  req->dev = block;
+  intr_set_level (old_level);
+
+  start_request (block, req);
+}
+
+/* Marks REQ completed, calls its callback, and wakes up any
+   thread waiting for it.  Called by drivers, possibly from an
+   interrupt handler. */
+void
+block_request_complete (struct block_request *req)
+{
+  enum intr_level old_level = intr_disable ();
+  uint64_t cycles = rdtsc () - req->start_cycles;
+
+  record_latency (req->block, cycles);
+  req->block->queue_depth--;
+  if (req->dev != req->block)
+    {
+      record_latency (req->dev, cycles);
+      req->dev->queue_depth--;
+    }
+  req->complete = true;
+  if (req->done != NULL)
+    req->done (req);
+  sema_up (&req->complete_sema);
+  intr_set_level (old_level);
+}
+
+/* Called by drivers that queue requests when they start
+   carrying out REQ, so that seek statistics reflect the order in
+   which requests actually reach the device.  MERGED says whether
+   REQ was merged into a single command with the request
+   started just before it. */
+void
+block_record_dispatch (struct block_request *req, bool merged)
+{
+  record_seek (req->dev, req->dev_sector, req->cnt);
+  if (merged)
+    req->dev->stats.merge_cnt++;
+}
+
+/* Checks REQ against BLOCK, updates BLOCK's statistics, and
+   hands REQ to BLOCK's driver.  Drivers that cannot queue
+   requests carry them out right away, before returning. */
+static void
+start_request (struct block *block, struct block_request *req)
+{
+  const struct block_operations *ops = block->ops;
+  block_sector_t sector = req->dev_sector;
+
+  check_sectors (block, sector, req->cnt);
+  ASSERT (!req->write || block->type != BLOCK_FOREIGN);
+  if (req->write)
+    block->stats.write_cnt += req->cnt;
+  else
+    block->stats.read_cnt += req->cnt;
+
+  if (ops->submit != NULL)
+    ops->submit (block->aux, req);
+  else
+    {
+      uint8_t *buffer = req->buffer;
+      size_t i;
+
+      record_seek (block, sector, req->cnt);
+
+      if (req->write && ops->write_multiple != NULL)
+        ops->write_multiple (block->aux, sector, req->cnt, buffer);
+      else if (!req->write && ops->read_multiple != NULL)
+        ops->read_multiple (block->aux, sector, req->cnt, buffer);
+      else
+        for (i = 0; i < req->cnt; i++)
+          if (req->write)
+            ops->write (block->aux, sector + i,
+                        buffer + i * BLOCK_SECTOR_SIZE);
+          else
+            ops->read (block->aux, sector + i,
+                       buffer + i * BLOCK_SECTOR_SIZE);
+      block_request_complete (req);
+    }
+}
+
+/* Counts a request newly queued on BLOCK toward BLOCK's queue
+   depth statistics.  Must be called with interrupts off. */
+static void
+count_request (struct block *block)
+{
+  block->queue_depth++;
+  if (block->queue_depth > block->stats.peak_queue_depth)
+    block->stats.peak_queue_depth = block->queue_depth;
+  block->stats.depth_total += block->queue_depth;
+  block->stats.request_cnt++;
+}
+
+/* Adds the distance from the end of BLOCK's previous I/O to
+   SECTOR to BLOCK's seek statistics, for an I/O of CNT sectors
+   that is just starting. */
+static void
+record_seek (struct block *block, block_sector_t sector, size_t cnt)
+{
+  if (block->stats.transfer_cnt++ > 0)
+    {
+      block->stats.seek_total += (sector > block->last_sector
+                                  ? sector - block->last_sector
+                                  : block->last_sector - sector);
+      if (sector == block->last_sector + 1)
+        block->stats.sequential_cnt++;
+    }
+  block->last_sector = sector + cnt - 1;
+}
+
+/* Adds a request that took CYCLES CPU cycles to complete to
+   BLOCK's latency histogram. */
+static void
+record_latency (struct block *block, uint64_t cycles)
+{
+  int bucket = 0;
+
+  while (cycles > 1 && bucket < LATENCY_BUCKETS - 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  block->stats.latency[bucket]++;
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,22 +55,98 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests. */
+
+struct block_request;
+
+/* Called when a block request completes, with interrupts off,
+   possibly from an interrupt handler.  Must not sleep. */
+typedef void block_request_func (struct block_request *);
+
+/* A request to read or write consecutive sectors of a block
+   device.  The submitter owns the request and must keep it
+   alive, and must not touch BUFFER, until the request
+   completes. */
+struct block_request
+  {
+    /* Set up by block_request_init(). */
+    bool write;                         /* Write? (Otherwise read.) */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_request_func *done;           /* Completion callback or null. */
+    void *aux;                          /* For use by DONE. */
+
+    /* Owned by the block layer and the driver. */
+    struct block *block;                /* Device submitted to. */
+    struct block *dev;                  /* Device that handles the
+                                           request, after any
+                                           block_forward(). */
+    int64_t start_time;                 /* Timer ticks at submission. */
+    uint64_t start_cycles;              /* CPU cycles at submission. */
+    struct list_elem elem;              /* Element in a driver queue. */
+    block_sector_t dev_sector;          /* SECTOR on the device that
+                                           handles the request. */
+    void *driver;                       /* Driver's data. */
+    bool complete;                      /* Completed yet? */
+    struct semaphore complete_sema;     /* Up'd on completion. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer,
+                         block_request_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+bool block_request_poll (const struct block_request *);
+void block_request_wait (struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
+void block_print_all_stats (void);
+void block_reset_stats (void);
+unsigned long long block_read_cnt (struct block *);
+unsigned long long block_write_cnt (struct block *);
 
 /* Lower-level interface to block device drivers. */
 
+/* A driver provides either SUBMIT, or READ and WRITE and
+   optionally READ_MULTIPLE and WRITE_MULTIPLE. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT consecutive sectors at once.  Optional: if
+       null, the block layer calls read or write once per
+       sector instead. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Starts carrying out REQ, starting at its dev_sector, and
+       returns without waiting for it to finish.  The driver calls
+       block_request_complete() when it has. */
+    void (*submit) (void *aux, struct block_request *req);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_forward (struct block *, struct block_request *);
+
+/* Called before a write of CNT sectors starting at SECTOR. */
+typedef void block_write_hook_func (void *aux, block_sector_t sector,
+                                    size_t cnt);
+void block_set_write_hook (struct block *, block_write_hook_func *,
+                           void *aux);
+void block_request_complete (struct block_request *);
+void block_record_dispatch (struct block_request *, bool merged);
 
 #endif /* devices/block.h */
@@ -0,0 +1,288 @@
+#include "devices/checksum.h"
+#include <crc32c.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A block device stacked on top of another, its "parent", that
+   detects silent corruption of the parent's data.
+
+   The parent is divided into data sectors, which the checksum
+   device exposes as its own, followed by a header sector and a
+   table holding the CRC-32C of each data sector, 128 to a
+   sector.  Every write updates the table, and every read checks
+   the data against it and reports mismatches.  The whole table
+   is kept in memory.
+
+   Optionally, a background thread "scrubs" the device: it reads
+   and checks every data sector in turn, over and over, at a
+   limited rate, so that corruption is found even in data that
+   is rarely read. */
+
+/* Identifies a checksum header. */
+#define CHECKSUM_MAGIC 0x4d555343
+
+/* Number of CRCs in a sector of the table. */
+#define CRCS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (uint32_t))
+
+/* Number of sectors the scrubber reads at a time. */
+#define SCRUB_CHUNK 8
+
+/* On-disk header.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct checksum_header
+  {
+    unsigned magic;                     /* CHECKSUM_MAGIC. */
+    block_sector_t data_cnt;            /* Number of data sectors. */
+    uint32_t unused[126];               /* Not used. */
+  };
+
+/* A checksum device. */
+struct checksum_dev
+  {
+    struct block *block;                /* The checksum device. */
+    struct block *parent;               /* Underlying device. */
+    block_sector_t data_cnt;            /* Number of data sectors. */
+    block_sector_t table_start;         /* First sector of table. */
+    block_sector_t table_cnt;           /* Sectors in table. */
+    uint32_t *crcs;                     /* The table. */
+    struct lock lock;                   /* Serializes access. */
+    int scrub_rate;                     /* Sectors/second to scrub. */
+    unsigned long long error_cnt;       /* Mismatches found. */
+  };
+
+static struct block_operations checksum_operations;
+
+static void load_table (struct checksum_dev *);
+static void scrub_thread (void *dev_);
+
+/* Returns the CRC-32C of SECTOR, which is BLOCK_SECTOR_SIZE bytes
+   long. */
+static uint32_t
+sector_crc (const void *sector)
+{
+  return crc32c (0, sector, BLOCK_SECTOR_SIZE);
+}
+
+/* Creates a checksum device on top of PARENT, named after it
+   with ".crc" appended, and registers it with the block layer.
+   If PARENT has not been used for a checksum device before,
+   computes checksums for its current contents.  If SCRUB_RATE
+   is positive, also starts a thread that scrubs the device at
+   SCRUB_RATE sectors per second.  Returns the new device. */
+struct block *
+checksum_init (struct block *parent, int scrub_rate)
+{
+  struct checksum_dev *dev;
+  block_sector_t size = block_size (parent);
+  char name[16];
+
+  if (size < 2)
+    PANIC ("%s: too small for checksums", block_name (parent));
+
+  dev = malloc (sizeof *dev);
+  if (dev == NULL)
+    PANIC ("checksum device creation failed");
+  dev->parent = parent;
+
+  /* Lay out SIZE - 1 sectors as data and table, then the
+     header. */
+  dev->table_cnt = DIV_ROUND_UP (size - 1, CRCS_PER_SECTOR + 1);
+  dev->data_cnt = size - 1 - dev->table_cnt;
+  dev->table_start = dev->data_cnt + 1;
+  dev->crcs = malloc (dev->table_cnt * BLOCK_SECTOR_SIZE);
+  if (dev->crcs == NULL)
+    PANIC ("%s: out of memory for checksums", block_name (parent));
+  lock_init (&dev->lock);
+  dev->scrub_rate = scrub_rate;
+  dev->error_cnt = 0;
+
+  load_table (dev);
+
+  snprintf (name, sizeof name, "%s.crc", block_name (parent));
+  dev->block = block_register (name, BLOCK_RAW, NULL, dev->data_cnt,
+                               &checksum_operations, dev);
+  if (scrub_rate > 0)
+    thread_create ("scrub", PRI_MIN, scrub_thread, dev);
+  return dev->block;
+}
+
+/* Reads DEV's checksum table from disk, or, if DEV's parent does
+   not have a valid table yet, computes one from the parent's
+   current contents and writes it. */
+static void
+load_table (struct checksum_dev *dev)
+{
+  struct checksum_header *h;
+  block_sector_t sector;
+  uint8_t *buffer;
+
+  h = malloc (sizeof *h);
+  if (h == NULL)
+    PANIC ("%s: out of memory", block_name (dev->parent));
+  ASSERT (sizeof *h == BLOCK_SECTOR_SIZE);
+  block_read (dev->parent, dev->data_cnt, h);
+  if (h->magic == CHECKSUM_MAGIC && h->data_cnt == dev->data_cnt)
+    {
+      block_read_multiple (dev->parent, dev->table_start, dev->table_cnt,
+                           dev->crcs);
+      free (h);
+      return;
+    }
+
+  printf ("%s: computing checksums for %"PRDSNu" sectors\n",
+          block_name (dev->parent), dev->data_cnt);
+  buffer = malloc (SCRUB_CHUNK * BLOCK_SECTOR_SIZE);
+  if (buffer == NULL)
+    PANIC ("%s: out of memory", block_name (dev->parent));
+  memset (dev->crcs, 0, dev->table_cnt * BLOCK_SECTOR_SIZE);
+  for (sector = 0; sector < dev->data_cnt; sector += SCRUB_CHUNK)
+    {
+      size_t cnt = dev->data_cnt - sector;
+      size_t i;
+
+      if (cnt > SCRUB_CHUNK)
+        cnt = SCRUB_CHUNK;
+      block_read_multiple (dev->parent, sector, cnt, buffer);
+      for (i = 0; i < cnt; i++)
+        dev->crcs[sector + i] = sector_crc (buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  free (buffer);
+  block_write_multiple (dev->parent, dev->table_start, dev->table_cnt,
+                        dev->crcs);
+
+  memset (h, 0, sizeof *h);
+  h->magic = CHECKSUM_MAGIC;
+  h->data_cnt = dev->data_cnt;
+  block_write (dev->parent, dev->data_cnt, h);
+  free (h);
+}
+
+/* Checks the CNT sectors in BUFFER, read from SECTOR onward,
+   against DEV's checksums, and reports any that do not match.
+   The caller must hold DEV's lock. */
+static void
+verify (struct checksum_dev *dev, block_sector_t sector, size_t cnt,
+        const uint8_t *buffer)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (sector_crc (buffer + i * BLOCK_SECTOR_SIZE) != dev->crcs[sector + i])
+      {
+        dev->error_cnt++;
+        printf ("%s: checksum mismatch in sector %"PRDSNu"\n",
+                block_name (dev->block), sector + i);
+      }
+}
+
+/* Reads CNT sectors starting at SECTOR from checksum device DEV
+   into BUFFER, checking them against their checksums. */
+static void
+checksum_read_multiple (void *dev_, block_sector_t sector, size_t cnt,
+                        void *buffer)
+{
+  struct checksum_dev *dev = dev_;
+
+  lock_acquire (&dev->lock);
+  block_read_multiple (dev->parent, sector, cnt, buffer);
+  verify (dev, sector, cnt, buffer);
+  lock_release (&dev->lock);
+}
+
+/* Writes CNT sectors starting at SECTOR to checksum device DEV
+   from BUFFER, then writes the part of the checksum table that
+   covers them. */
+static void
+checksum_write_multiple (void *dev_, block_sector_t sector, size_t cnt,
+                         const void *buffer_)
+{
+  struct checksum_dev *dev = dev_;
+  const uint8_t *buffer = buffer_;
+  size_t first = sector / CRCS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / CRCS_PER_SECTOR;
+  size_t i;
+
+  lock_acquire (&dev->lock);
+  for (i = 0; i < cnt; i++)
+    dev->crcs[sector + i] = sector_crc (buffer + i * BLOCK_SECTOR_SIZE);
+  block_write_multiple (dev->parent, sector, cnt, buffer);
+  block_write_multiple (dev->parent, dev->table_start + first,
+                        last - first + 1,
+                        dev->crcs + first * CRCS_PER_SECTOR);
+  lock_release (&dev->lock);
+}
+
+/* Reads SECTOR from checksum device DEV into BUFFER. */
+static void
+checksum_read (void *dev, block_sector_t sector, void *buffer)
+{
+  checksum_read_multiple (dev, sector, 1, buffer);
+}
+
+/* Writes SECTOR to checksum device DEV from BUFFER. */
+static void
+checksum_write (void *dev, block_sector_t sector, const void *buffer)
+{
+  checksum_write_multiple (dev, sector, 1, buffer);
+}
+
+static struct block_operations checksum_operations =
+  {
+    .read = checksum_read,
+    .write = checksum_write,
+    .read_multiple = checksum_read_multiple,
+    .write_multiple = checksum_write_multiple
+  };
+
+/* Scrubs checksum device DEV_ forever, reading SCRUB_CHUNK
+   sectors at a time and sleeping between reads to stay at about
+   DEV_'s scrub_rate sectors per second.  Reports at the end of
+   each pass in which it found mismatches. */
+static void
+scrub_thread (void *dev_)
+{
+  struct checksum_dev *dev = dev_;
+  uint8_t *buffer = malloc (SCRUB_CHUNK * BLOCK_SECTOR_SIZE);
+
+  if (buffer == NULL)
+    {
+      printf ("%s: out of memory, not scrubbing\n", block_name (dev->block));
+      return;
+    }
+
+  for (;;)
+    {
+      unsigned long long old_error_cnt = dev->error_cnt;
+      int64_t start = timer_ticks ();
+      block_sector_t sector;
+
+      for (sector = 0; sector < dev->data_cnt; sector += SCRUB_CHUNK)
+        {
+          size_t cnt = dev->data_cnt - sector;
+          int64_t due;
+
+          if (cnt > SCRUB_CHUNK)
+            cnt = SCRUB_CHUNK;
+          lock_acquire (&dev->lock);
+          block_read_multiple (dev->parent, sector, cnt, buffer);
+          verify (dev, sector, cnt, buffer);
+          lock_release (&dev->lock);
+
+          /* Sleep until this many sectors are due. */
+          due = start + (int64_t) (sector + cnt) * TIMER_FREQ / dev->scrub_rate;
+          if (due > timer_ticks ())
+            timer_sleep (due - timer_ticks ());
+        }
+
+      if (dev->error_cnt != old_error_cnt)
+        printf ("%s: scrub found %llu mismatches\n", block_name (dev->block),
+                dev->error_cnt - old_error_cnt);
+    }
+}
@@ -0,0 +1,8 @@
+#ifndef DEVICES_CHECKSUM_H
+#define DEVICES_CHECKSUM_H
+
+struct block;
+
+struct block *checksum_init (struct block *parent, int scrub_rate);
+
+#endif /* devices/checksum.h */
@@ -3,15 +3,24 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
+#include "devices/iosched.h"
 #include "devices/partition.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Data is transferred by bus-master DMA if the channels belong
+   to a PCI IDE controller that supports it, such as the Intel
+   PIIX emulated by QEMU, and by PIO otherwise. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +43,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +59,46 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Maximum number of sectors transferred by one READ SECTOR or
+   WRITE SECTOR command.  A sector count of 0 in the command
+   means 256. */
+#define MAX_SECTORS_PER_CMD 256
+
+/* Bus-master IDE port addresses, relative to the channel's
+   bus-master base, as defined by the PCI IDE controller
+   specification. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus-master Status Register bits.  ERR and IRQ are cleared by
+   writing 1s to them. */
+#define BM_STA_ERR 0x02         /* Transfer failed. */
+#define BM_STA_IRQ 0x04         /* Disk raised its interrupt. */
+
+/* A physical region descriptor (PRD), which tells the
+   bus-master controller where in physical memory to transfer a
+   region of up to 64 kB that does not cross a 64 kB boundary.
+   A PRD table is an array of these, ending with one that has
+   PRD_EOT set. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, must be even. */
+    uint16_t size;              /* Byte count, 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT or 0. */
+  };
+#define PRD_EOT 0x8000          /* Last entry in table. */
+
+/* Number of PRDs in a channel's PRD table, which occupies one
+   page so that it cannot cross a 64 kB boundary. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +107,13 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool use_dma;               /* Transfer data with bus-master DMA? */
+
+    /* Set by probing, for registration afterward. */
+    block_sector_t capacity;    /* Size in sectors. */
+    char model[21];             /* Model name. */
+    char serial[41];            /* Serial number. */
+    int64_t probe_ticks;        /* Timer ticks taken to probe. */
   };
 
 /* An ATA channel (aka controller).
@@ -66,11 +123,24 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus-master base I/O port, or 0 if the
+                                   channel cannot do DMA. */
+    struct prd *prdt;           /* PRD table, if bm_base != 0. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
-    struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct semaphore completion_wait;   /* Up'd by interrupt handler
+                                           while no request is in
+                                           progress. */
+
+    /* Block requests.  Accessed only with interrupts off. */
+    struct iosched sched;       /* Requests waiting to start. */
+    struct list batch;          /* Requests in progress, in sector
+                                   order, or empty if idle. */
+    size_t front_done;          /* Sectors of first request in BATCH
+                                   already transferred. */
+    size_t cmd_left;            /* Sectors left in current command. */
+    bool dma;                   /* Current command uses DMA? */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -81,32 +151,51 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static void probe_channel (void *c_);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void register_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static bool build_prdt (struct channel *, size_t cnt);
+static void continue_request (struct channel *);
+
+static uint16_t find_bus_master (void);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static void backoff (unsigned *delay, int64_t *waited);
+static bool wait_for_drq (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
-/* Initialize the disk subsystem and detect disks. */
+/* Up'd by each channel's probe thread when it finishes. */
+static struct semaphore probe_done;
+
+/* Initialize the disk subsystem and detect disks.
+   The channels are probed in parallel, one thread each, so that
+   waiting for one channel's disks does not hold up the other.
+   Then the disks found are registered in order, so that their
+   names and roles do not depend on which probe finished first. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
+  int64_t start = timer_ticks ();
   size_t chan_no;
+  int dev_no;
+
+  sema_init (&probe_done, 0);
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
-      int dev_no;
 
       /* Initialize channel. */
       snprintf (c->name, sizeof c->name, "ide%zu", chan_no);
@@ -123,9 +212,21 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      iosched_init (&c->sched);
+      list_init (&c->batch);
+
+      /* Set up bus-master DMA, if available.  Each channel has
+         8 bus-master ports, primary first. */
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,29 +237,68 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->use_dma = false;
         }
 
       /* Register interrupt handler. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
 
-      /* Reset hardware. */
-      reset_channel (c);
-
-      /* Distinguish ATA hard disks from other devices. */
-      if (check_device_type (&c->devices[0]))
-        check_device_type (&c->devices[1]);
-
-      /* Read hard disk identity information. */
-      for (dev_no = 0; dev_no < 2; dev_no++)
-        if (c->devices[dev_no].is_ata)
-          identify_ata_device (&c->devices[dev_no]);
+      /* Probe devices. */
+      if (thread_create (c->name, PRI_DEFAULT, probe_channel, c) == TID_ERROR)
+        probe_channel (c);
     }
+
+  /* Wait for probing to finish, then register disks. */
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    sema_down (&probe_done);
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    for (dev_no = 0; dev_no < 2; dev_no++)
+      {
+        struct ata_disk *d = &channels[chan_no].devices[dev_no];
+        if (d->is_ata)
+          register_ata_device (d);
+        else
+          printf ("%s: no ATA disk, probed in %lld ms\n",
+                  d->name, d->probe_ticks * 1000 / TIMER_FREQ);
+      }
+  printf ("ide: probed %d channels in %lld ms\n",
+          CHANNEL_CNT, timer_elapsed (start) * 1000 / TIMER_FREQ);
 }
 
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
 
+/* Thread function that resets channel C_, finds out which of its
+   devices are ATA disks, and identifies them, then ups
+   probe_done. */
+static void
+probe_channel (void *c_)
+{
+  struct channel *c = c_;
+  int64_t start = timer_ticks ();
+  int dev_no;
+
+  /* Reset hardware. */
+  reset_channel (c);
+
+  /* Distinguish ATA hard disks from other devices. */
+  if (check_device_type (&c->devices[0]))
+    check_device_type (&c->devices[1]);
+
+  /* Read hard disk identity information.  Each device's probe
+     time includes resetting the channel. */
+  for (dev_no = 0; dev_no < 2; dev_no++)
+    {
+      struct ata_disk *d = &c->devices[dev_no];
+      if (d->is_ata)
+        identify_ata_device (d);
+      d->probe_ticks = timer_elapsed (start);
+    }
+
+  sema_up (&probe_done);
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -188,6 +328,10 @@ reset_channel (struct channel *c)
                          && inb (reg_lbal (c)) == 0xaa);
     }
 
+  /* With no devices there is nothing to wait for. */
+  if (!present[0] && !present[1])
+    return;
+
   /* Issue soft reset sequence, which selects device 0 as a side effect.
      Also enable interrupts. */
   outb (reg_ctl (c), 0);
@@ -196,7 +340,8 @@ reset_channel (struct channel *c)
   timer_usleep (10);
   outb (reg_ctl (c), 0);
 
-  timer_msleep (150);
+  /* ATA requires waiting at least 2 ms before polling BSY. */
+  timer_msleep (2);
 
   /* Wait for device 0 to clear BSY. */
   if (present[0]) 
@@ -208,14 +353,15 @@ reset_channel (struct channel *c)
   /* Wait for device 1 to clear BSY. */
   if (present[1])
     {
-      int i;
+      unsigned delay = 10;
+      int64_t waited = 0;
 
       select_device (&c->devices[1]);
-      for (i = 0; i < 3000; i++) 
+      while (waited < 30 * 1000 * 1000)
         {
           if (inb (reg_nsect (c)) == 1 && inb (reg_lbal (c)) == 1)
             break;
-          timer_msleep (10);
+          backoff (&delay, &waited);
         }
       wait_while_busy (&c->devices[1]);
     }
@@ -254,17 +400,12 @@ check_device_type (struct ata_disk *d)
 }
 
 /* Sends an IDENTIFY DEVICE command to disk D and reads the
-   response.  Registers the disk with the block device
-   layer. */
+   response into D. */
 static void
 identify_ata_device (struct ata_disk *d) 
 {
   struct channel *c = d->channel;
   char id[BLOCK_SECTOR_SIZE];
-  block_sector_t capacity;
-  char *model, *serial;
-  char extra_info[128];
-  struct block *block;
 
   ASSERT (d->is_ata);
 
@@ -283,11 +424,30 @@ identify_ata_device (struct ata_disk *d)
 
   /* Calculate capacity.
      Read model name and serial number. */
-  capacity = *(uint32_t *) &id[60 * 2];
-  model = descramble_ata_string (&id[10 * 2], 20);
-  serial = descramble_ata_string (&id[27 * 2], 40);
+  d->capacity = *(uint32_t *) &id[60 * 2];
+  strlcpy (d->model, descramble_ata_string (&id[10 * 2], 20),
+           sizeof d->model);
+  strlcpy (d->serial, descramble_ata_string (&id[27 * 2], 40),
+           sizeof d->serial);
+
+  /* Use DMA if both the channel and the disk support it.  Bit 8
+     of word 49 says whether the disk does. */
+  d->use_dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100);
+}
+
+/* Registers disk D, which has been identified, with the block
+   device layer and scans it for partitions. */
+static void
+register_ata_device (struct ata_disk *d)
+{
+  block_sector_t capacity = d->capacity;
+  char extra_info[128];
+  struct block *block;
+
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s, probed in %lld ms",
+            d->model, d->serial, d->use_dma ? ", DMA" : "",
+            d->probe_ticks * 1000 / TIMER_FREQ);
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -337,63 +497,246 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Asynchronous request processing.
+
+   Each channel has a queue of block requests, managed by an I/O
+   scheduler.  The channel carries out one batch of requests at a
+   time, as chosen and merged by the scheduler, as a series of
+   commands of up to MAX_SECTORS_PER_CMD sectors each.  The
+   disk's interrupt at the end of each command (or, in PIO mode,
+   of each sector) moves the data, completes the requests that
+   are done, and starts the next command or the next batch.
+   Thus the disk stays busy without help from the threads that
+   submitted the requests, and the two channels work in
+   parallel.
+
+   The queue and the state of the current batch are accessed
+   only with interrupts off.  Because this code runs in the
+   interrupt handler, it busy-waits instead of sleeping. */
+
+static void start_batch (struct channel *);
+static void start_command (struct channel *);
+
+/* Queues block request REQ for disk D, starting it right away
+   if D's channel is idle. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_submit (void *d_, struct block_request *req)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  enum intr_level old_level;
+
+  req->driver = d;
+  old_level = intr_disable ();
+  iosched_add (&c->sched, req);
+  if (list_empty (&c->batch))
+    start_batch (c);
+  intr_set_level (old_level);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+static struct block_operations ide_operations =
+  {
+    .submit = ide_submit
+  };
+
+/* Starts the next batch of requests chosen by idle channel C's
+   scheduler, if any are waiting. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+start_batch (struct channel *c)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (list_empty (&c->batch));
+
+  if (!iosched_empty (&c->sched))
+    {
+      iosched_next (&c->sched, &c->batch, MAX_SECTORS_PER_CMD);
+      c->front_done = 0;
+      start_command (c);
+    }
+}
+
+/* Returns the first request in channel C's batch. */
+static struct block_request *
+batch_front (struct channel *c)
+{
+  return list_entry (list_front (&c->batch), struct block_request, elem);
+}
+
+/* Returns the number of sectors left to transfer in channel C's
+   batch. */
+static size_t
+batch_left (struct channel *c)
+{
+  struct list_elem *e;
+  size_t cnt = 0;
+
+  for (e = list_begin (&c->batch); e != list_end (&c->batch);
+       e = list_next (e))
+    cnt += list_entry (e, struct block_request, elem)->cnt;
+  return cnt - c->front_done;
+}
+
+/* Returns the address of the data for the sector OFS sectors
+   past the next one to transfer in channel C's batch. */
+static uint8_t *
+batch_buffer (struct channel *c, size_t ofs)
+{
+  struct list_elem *e;
+
+  ofs += c->front_done;
+  for (e = list_begin (&c->batch); e != list_end (&c->batch);
+       e = list_next (e))
+    {
+      struct block_request *req = list_entry (e, struct block_request, elem);
+      if (ofs < req->cnt)
+        return (uint8_t *) req->buffer + ofs * BLOCK_SECTOR_SIZE;
+      ofs -= req->cnt;
+    }
+  NOT_REACHED ();
+}
+
+/* Records that the next CNT sectors of channel C's batch have
+   been transferred, completing each request that is now done. */
+static void
+advance_batch (struct channel *c, size_t cnt)
+{
+  while (cnt > 0)
+    {
+      struct block_request *req = batch_front (c);
+      size_t left = req->cnt - c->front_done;
+
+      if (cnt < left)
+        {
+          c->front_done += cnt;
+          break;
+        }
+      cnt -= left;
+      list_pop_front (&c->batch);
+      c->front_done = 0;
+      block_request_complete (req);
+    }
+}
+
+/* Issues the command for the next MAX_SECTORS_PER_CMD or fewer
+   sectors of channel C's batch.  Uses DMA if the disk and the
+   buffers allow it, otherwise PIO, in which case the first
+   sector of a write is sent right away. */
+static void
+start_command (struct channel *c)
+{
+  struct block_request *req = batch_front (c);
+  struct ata_disk *d = req->driver;
+  block_sector_t sec_no = req->dev_sector + c->front_done;
+  size_t cnt = batch_left (c);
+
+  if (cnt > MAX_SECTORS_PER_CMD)
+    cnt = MAX_SECTORS_PER_CMD;
+  c->cmd_left = cnt;
+  c->dma = d->use_dma && build_prdt (c, cnt);
+
+  if (c->dma)
+    {
+      uint8_t direction = req->write ? 0 : BM_CMD_READ;
+
+      /* Program the bus-master controller, clearing any old error
+         or interrupt status, then issue the command and start the
+         transfer. */
+      outb (reg_bm_command (c), direction);
+      outb (reg_bm_status (c),
+            inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_IRQ);
+      outl (reg_bm_prdt (c), vtop (c->prdt));
+      select_sector (d, sec_no, cnt);
+      issue_pio_command (c, req->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+      outb (reg_bm_command (c), direction | BM_CMD_START);
+    }
+  else
+    {
+      select_sector (d, sec_no, cnt);
+      issue_pio_command (c, (req->write
+                             ? CMD_WRITE_SECTOR_RETRY
+                             : CMD_READ_SECTOR_RETRY));
+      if (req->write)
+        {
+          if (!wait_for_drq (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no);
+          output_sector (c, batch_buffer (c, 0));
+        }
+    }
+}
+
+/* Handles an interrupt from channel C, which has a batch in
+   progress.  Moves data as needed, then starts the next command
+   or batch. */
+static void
+continue_request (struct channel *c)
+{
+  struct block_request *req = batch_front (c);
+  struct ata_disk *d = req->driver;
+  bool write = req->write;
+  block_sector_t sec_no = req->dev_sector + c->front_done;
+  uint8_t status = inb (reg_status (c));        /* Acknowledge interrupt. */
+
+  if (c->dma)
+    {
+      uint8_t bm_status;
+
+      /* Stop the bus-master controller and check for errors. */
+      outb (reg_bm_command (c), write ? 0 : BM_CMD_READ);
+      bm_status = inb (reg_bm_status (c));
+      outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_IRQ);
+      if ((bm_status & BM_STA_ERR) != 0 || (status & STA_ERR) != 0)
+        PANIC ("%s: disk DMA %s failed, sector=%"PRDSNu,
+               d->name, write ? "write" : "read", sec_no);
+      advance_batch (c, c->cmd_left);
+      c->cmd_left = 0;
+    }
+  else if (!write)
+    {
+      /* A sector is ready to be read. */
+      if ((status & STA_ERR) != 0 || !wait_for_drq (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
+      input_sector (c, batch_buffer (c, 0));
+      advance_batch (c, 1);
+      c->cmd_left--;
+    }
+  else
+    {
+      /* The disk has accepted a sector.  Send it the next one, if
+         the command has more. */
+      if ((status & STA_ERR) != 0)
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+      advance_batch (c, 1);
+      if (--c->cmd_left > 0)
+        {
+          if (!wait_for_drq (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + 1);
+          output_sector (c, batch_buffer (c, 0));
+        }
+    }
+
+  if (c->cmd_left > 0)
+    return;
+  if (!list_empty (&c->batch))
+    start_command (c);
+  else
+    start_batch (c);
 }
 
-static struct block_operations ide_operations =
-  {
-    ide_read,
-    ide_write
-  };
-
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_SECTORS_PER_CMD);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS_PER_CMD ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -406,10 +749,6 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
-  /* Interrupts must be enabled or our semaphore will never be
-     up'd by the completion handler. */
-  ASSERT (intr_get_level () == INTR_ON);
-
   c->expecting_interrupt = true;
   outb (reg_command (c), command);
 }
@@ -430,6 +769,114 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Bus-master DMA. */
+
+/* Fills in channel C's PRD table to describe the buffers for the
+   next CNT sectors of its batch.  Returns true if successful,
+   false if a buffer cannot be used for DMA because it is not in
+   kernel memory (whose physical pages are contiguous), is not
+   2-byte aligned, or the buffers need too many PRDs. */
+static bool
+build_prdt (struct channel *c, size_t cnt)
+{
+  size_t prd_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      const uint8_t *buffer = batch_buffer (c, i);
+      size_t size = BLOCK_SECTOR_SIZE;
+      uint32_t addr;
+
+      if (!is_kernel_vaddr (buffer) || (uintptr_t) buffer % 2 != 0)
+        return false;
+
+      addr = vtop (buffer);
+      while (size > 0)
+        {
+          struct prd *last = prd_cnt > 0 ? &c->prdt[prd_cnt - 1] : NULL;
+          size_t chunk = 0x10000 - (addr & 0xffff);
+          if (chunk > size)
+            chunk = size;
+
+          /* Extend the previous PRD if this region continues it
+             within the same 64 kB, otherwise add a new one. */
+          if (last != NULL && (addr & 0xffff) != 0
+              && last->addr + last->size == addr)
+            last->size += chunk;
+          else if (prd_cnt < PRD_CNT)
+            {
+              struct prd *prd = &c->prdt[prd_cnt++];
+              prd->addr = addr;
+              prd->size = chunk & 0xffff;
+              prd->flags = 0;
+            }
+          else
+            return false;
+          addr += chunk;
+          size -= chunk;
+        }
+    }
+  c->prdt[prd_cnt - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* PCI configuration space ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Selects register REG of PCI function FUNC of device DEV on
+   bus 0 for access through PCI_CONFIG_DATA. */
+static void
+pci_select (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that can do
+   bus-master DMA and that drives the legacy ATA channels, which
+   is all that we support.  If found, enables bus mastering and
+   returns its bus-master base I/O port.  Otherwise, returns 0. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4, command;
+
+        pci_select (dev, func, 0x00);
+        if ((inl (PCI_CONFIG_DATA) & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 01h (mass storage), subclass 01h (IDE),
+           programming interface with bit 7 (bus master) set and
+           bits 0 and 2 (native mode) clear. */
+        pci_select (dev, func, 0x08);
+        class = inl (PCI_CONFIG_DATA) >> 8;
+        if ((class >> 8) != 0x0101 || (class & 0x85) != 0x80)
+          continue;
+
+        /* BAR4 holds the bus-master base, which must be in I/O
+           space. */
+        pci_select (dev, func, 0x20);
+        bar4 = inl (PCI_CONFIG_DATA);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space access and bus mastering. */
+        pci_select (dev, func, 0x04);
+        command = inl (PCI_CONFIG_DATA);
+        pci_select (dev, func, 0x04);
+        outl (PCI_CONFIG_DATA, (command & 0xffff) | 0x05);
+
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -446,7 +893,7 @@ wait_until_idle (const struct ata_disk *d)
     {
       if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
         return;
-      timer_usleep (10);
+      timer_udelay (10);
     }
 
   printf ("%s: idle timeout\n", d->name);
@@ -455,30 +902,67 @@ wait_until_idle (const struct ata_disk *d)
 /* Wait up to 30 seconds for disk D to clear BSY,
    and then return the status of the DRQ bit.
    The ATA standards say that a disk may take as long as that to
-   complete its reset. */
+   complete its reset.  Polls quickly at first, backing off to
+   every 10 ms, so that fast disks do not wait longer than they
+   need to. */
 static bool
 wait_while_busy (const struct ata_disk *d) 
 {
   struct channel *c = d->channel;
-  int i;
+  unsigned delay = 10;
+  int64_t waited = 0;
+  bool warned = false;
   
-  for (i = 0; i < 3000; i++)
+  while (waited < 30 * 1000 * 1000)
     {
-      if (i == 700)
-        printf ("%s: busy, waiting...", d->name);
+      if (!warned && waited >= 7 * 1000 * 1000)
+        {
+          printf ("%s: busy, waiting...", d->name);
+          warned = true;
+        }
       if (!(inb (reg_alt_status (c)) & STA_BSY)) 
         {
-          if (i >= 700)
+          if (warned)
             printf ("ok\n");
           return (inb (reg_alt_status (c)) & STA_DRQ) != 0;
         }
-      timer_msleep (10);
+      backoff (&delay, &waited);
     }
 
   printf ("failed\n");
   return false;
 }
 
+/* Sleeps for *DELAY microseconds while polling a disk, adds them
+   to *WAITED, and doubles *DELAY, up to 10 ms. */
+static void
+backoff (unsigned *delay, int64_t *waited)
+{
+  timer_usleep (*delay);
+  *waited += *delay;
+  if (*delay < 10 * 1000)
+    *delay *= 2;
+}
+
+/* Busy-waits up to about 10 ms for disk D to clear BSY, then
+   returns whether DRQ is set and ERR is clear.  Unlike
+   wait_while_busy(), may be called with interrupts off. */
+static bool
+wait_for_drq (const struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  int i;
+
+  for (i = 0; i < 1000; i++)
+    {
+      uint8_t status = inb (reg_alt_status (c));
+      if (!(status & STA_BSY))
+        return (status & (STA_DRQ | STA_ERR)) == STA_DRQ;
+      timer_udelay (10);
+    }
+  return false;
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -489,7 +973,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -511,7 +995,9 @@ interrupt_handler (struct intr_frame *f)
   for (c = channels; c < channels + CHANNEL_CNT; c++)
     if (f->vec_no == c->irq)
       {
-        if (c->expecting_interrupt) 
+        if (c->expecting_interrupt && !list_empty (&c->batch))
+          continue_request (c);
+        else if (c->expecting_interrupt) 
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
@@ -0,0 +1,181 @@
+#include "devices/iosched.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+
+/* Pluggable I/O scheduler.
+
+   Requests wait in arrival order in a queue.  When the driver is
+   ready for more work, iosched_next() picks a request according
+   to the policy, then merges into it any other waiting requests
+   that continue it on disk in the same direction, so that the
+   driver can transfer them all with one command:
+
+     - IOSCHED_NOOP picks the oldest request.
+
+     - IOSCHED_CLOOK picks the request with the lowest sector at
+       or after the end of the previous batch, or the lowest
+       sector overall if there is none, so that the disk head
+       sweeps upward and then jumps back, instead of thrashing
+       between requests in different parts of the disk.
+
+     - IOSCHED_DEADLINE works like IOSCHED_CLOOK, except that the
+       oldest request is picked first once it has waited longer
+       than its deadline, so that a stream of requests at one end
+       of the disk cannot starve a request at the other end.
+       Reads, which usually have a thread waiting on them, get a
+       shorter deadline than writes. */
+
+/* Deadlines, in timer ticks. */
+#define READ_DEADLINE (TIMER_FREQ / 20)         /* 50 ms. */
+#define WRITE_DEADLINE (TIMER_FREQ / 2)         /* 500 ms. */
+
+/* Policy for newly initialized schedulers. */
+static enum iosched_policy default_policy = IOSCHED_CLOOK;
+
+/* Sets the policy used by schedulers initialized afterward to
+   the one called NAME: "noop", "clook", or "deadline".  Returns
+   true if successful, false if NAME is not a policy. */
+bool
+iosched_set_default (const char *name)
+{
+  if (name == NULL)
+    return false;
+  else if (!strcmp (name, "noop"))
+    default_policy = IOSCHED_NOOP;
+  else if (!strcmp (name, "clook"))
+    default_policy = IOSCHED_CLOOK;
+  else if (!strcmp (name, "deadline"))
+    default_policy = IOSCHED_DEADLINE;
+  else
+    return false;
+  return true;
+}
+
+/* Initializes S as an empty queue with the default policy. */
+void
+iosched_init (struct iosched *s)
+{
+  s->policy = default_policy;
+  list_init (&s->queue);
+  s->head = 0;
+}
+
+/* Adds REQ to the requests waiting in S. */
+void
+iosched_add (struct iosched *s, struct block_request *req)
+{
+  list_push_back (&s->queue, &req->elem);
+}
+
+/* Returns true if no requests are waiting in S. */
+bool
+iosched_empty (struct iosched *s)
+{
+  return list_empty (&s->queue);
+}
+
+/* Returns the waiting request in S with the lowest sector at or
+   after S's head, or with the lowest sector overall if there is
+   none. */
+static struct block_request *
+pick_clook (struct iosched *s)
+{
+  struct block_request *ahead = NULL, *lowest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&s->queue); e != list_end (&s->queue);
+       e = list_next (e))
+    {
+      struct block_request *req = list_entry (e, struct block_request, elem);
+      if (req->dev_sector >= s->head
+          && (ahead == NULL || req->dev_sector < ahead->dev_sector))
+        ahead = req;
+      if (lowest == NULL || req->dev_sector < lowest->dev_sector)
+        lowest = req;
+    }
+  return ahead != NULL ? ahead : lowest;
+}
+
+/* Returns the request in S to start next according to S's
+   policy.  S must not be empty. */
+static struct block_request *
+pick (struct iosched *s)
+{
+  struct block_request *oldest = list_entry (list_front (&s->queue),
+                                             struct block_request, elem);
+
+  switch (s->policy)
+    {
+    case IOSCHED_NOOP:
+      return oldest;
+
+    case IOSCHED_DEADLINE:
+      if (timer_elapsed (oldest->start_time)
+          >= (oldest->write ? WRITE_DEADLINE : READ_DEADLINE))
+        return oldest;
+      return pick_clook (s);
+
+    case IOSCHED_CLOOK:
+      return pick_clook (s);
+
+    default:
+      NOT_REACHED ();
+    }
+}
+
+/* Returns a waiting request in S for the same device (as
+   identified by the driver member) and in the same direction as
+   REQ that begins right after REQ ends on disk, or a null
+   pointer if there is none. */
+static struct block_request *
+find_successor (struct iosched *s, const struct block_request *req)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&s->queue); e != list_end (&s->queue);
+       e = list_next (e))
+    {
+      struct block_request *next = list_entry (e, struct block_request,
+                                               elem);
+      if (next->driver == req->driver && next->write == req->write
+          && next->dev_sector == req->dev_sector + req->cnt)
+        return next;
+    }
+  return NULL;
+}
+
+/* Moves the requests that the driver should carry out next from
+   S to the empty list BATCH, in sector order.  Each request in
+   BATCH begins on disk where the previous one ends, and all of
+   them are reads or all are writes.  Requests are merged only
+   while the batch stays within MAX_SECTORS sectors, although a
+   single request may be larger than that.  Returns the number
+   of sectors in the batch.  S must not be empty. */
+size_t
+iosched_next (struct iosched *s, struct list *batch, size_t max_sectors)
+{
+  struct block_request *req = pick (s);
+  size_t sector_cnt = req->cnt;
+
+  ASSERT (list_empty (batch));
+
+  list_remove (&req->elem);
+  list_push_back (batch, &req->elem);
+  block_record_dispatch (req, false);
+  for (;;)
+    {
+      struct block_request *next = find_successor (s, req);
+      if (next == NULL || sector_cnt + next->cnt > max_sectors)
+        break;
+
+      list_remove (&next->elem);
+      list_push_back (batch, &next->elem);
+      block_record_dispatch (next, true);
+      sector_cnt += next->cnt;
+      req = next;
+    }
+  s->head = req->dev_sector + req->cnt;
+
+  return sector_cnt;
+}
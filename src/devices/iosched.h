@@ -0,0 +1,36 @@
+#ifndef DEVICES_IOSCHED_H
+#define DEVICES_IOSCHED_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* I/O scheduling policies. */
+enum iosched_policy
+  {
+    IOSCHED_NOOP,               /* First come, first served. */
+    IOSCHED_CLOOK,              /* C-LOOK elevator. */
+    IOSCHED_DEADLINE            /* C-LOOK, but expired requests first. */
+  };
+
+/* A queue of block requests waiting for a device, from which
+   the device's driver takes batches of adjacent requests in the
+   order chosen by a scheduling policy.  Not synchronized: the
+   driver must protect it, e.g. by turning off interrupts. */
+struct iosched
+  {
+    enum iosched_policy policy; /* Scheduling policy. */
+    struct list queue;          /* Waiting requests, oldest first. */
+    block_sector_t head;        /* Sector just after the last batch. */
+  };
+
+bool iosched_set_default (const char *name);
+
+void iosched_init (struct iosched *);
+void iosched_add (struct iosched *, struct block_request *);
+bool iosched_empty (struct iosched *);
+size_t iosched_next (struct iosched *, struct list *batch,
+                     size_t max_sectors);
+
+#endif /* devices/iosched.h */
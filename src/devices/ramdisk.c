@@ -0,0 +1,140 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device stored in memory, for benchmarking file system
+   code without the cost of emulated disk I/O, or for fast
+   scratch space.  Its contents do not survive shutdown.
+
+   The disk's memory comes from the kernel pool one page at a
+   time, so it need not be contiguous. */
+
+/* Sectors per page of memory. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *ramdisk;   /* The RAM disk, if any. */
+static uint8_t **pages;         /* Its pages. */
+
+static struct block_operations ramdisk_operations;
+
+/* Returns the address of SECTOR's data in the RAM disk. */
+static uint8_t *
+sector_data (block_sector_t sector)
+{
+  return pages[sector / SECTORS_PER_PAGE]
+         + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE;
+}
+
+/* Creates a RAM disk named "ram0" of KB kilobytes, rounded up to
+   a whole number of pages, initially all zeros, and registers it
+   with the block layer.  Panics if there is not enough memory. */
+void
+ramdisk_init (size_t kb)
+{
+  size_t page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  size_t array_pages = DIV_ROUND_UP (page_cnt * sizeof *pages, PGSIZE);
+  char extra_info[32];
+  size_t i;
+
+  ASSERT (ramdisk == NULL);
+  if (page_cnt == 0)
+    return;
+
+  pages = palloc_get_multiple (0, array_pages);
+  if (pages == NULL)
+    PANIC ("ram0: out of memory");
+  for (i = 0; i < page_cnt; i++)
+    {
+      pages[i] = palloc_get_page (PAL_ZERO);
+      if (pages[i] == NULL)
+        PANIC ("ram0: out of memory after %zu of %zu pages", i, page_cnt);
+    }
+
+  snprintf (extra_info, sizeof extra_info, "%zu pages", page_cnt);
+  ramdisk = block_register ("ram0", BLOCK_RAW, extra_info,
+                            page_cnt * SECTORS_PER_PAGE,
+                            &ramdisk_operations, NULL);
+}
+
+/* Copies the contents of block device FROM into the RAM disk,
+   as much as fits, so that the RAM disk can stand in for it. */
+void
+ramdisk_load (struct block *from)
+{
+  block_sector_t cnt;
+  block_sector_t sector;
+  int64_t start;
+
+  ASSERT (from != NULL);
+  if (ramdisk == NULL)
+    PANIC ("ram0: no RAM disk to load into");
+  if (from == ramdisk)
+    PANIC ("ram0: cannot load RAM disk from itself");
+
+  cnt = block_size (from);
+  if (cnt > block_size (ramdisk))
+    cnt = block_size (ramdisk);
+
+  start = timer_ticks ();
+  for (sector = 0; sector < cnt; sector += SECTORS_PER_PAGE)
+    {
+      block_sector_t page_cnt = cnt - sector;
+      if (page_cnt > SECTORS_PER_PAGE)
+        page_cnt = SECTORS_PER_PAGE;
+      block_read_multiple (from, sector, page_cnt, sector_data (sector));
+    }
+  printf ("ram0: loaded %"PRDSNu" sectors from %s in %"PRId64" ms\n",
+          cnt, block_name (from), timer_elapsed (start) * 1000 / TIMER_FREQ);
+}
+
+/* Reads CNT sectors starting at SECTOR from the RAM disk into
+   BUFFER. */
+static void
+ramdisk_read_multiple (void *aux UNUSED, block_sector_t sector, size_t cnt,
+                       void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  for (; cnt > 0; cnt--, sector++, buffer += BLOCK_SECTOR_SIZE)
+    memcpy (buffer, sector_data (sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes CNT sectors starting at SECTOR to the RAM disk from
+   BUFFER. */
+static void
+ramdisk_write_multiple (void *aux UNUSED, block_sector_t sector, size_t cnt,
+                        const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+
+  for (; cnt > 0; cnt--, sector++, buffer += BLOCK_SECTOR_SIZE)
+    memcpy (sector_data (sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SECTOR from the RAM disk into BUFFER. */
+static void
+ramdisk_read (void *aux, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multiple (aux, sector, 1, buffer);
+}
+
+/* Writes SECTOR to the RAM disk from BUFFER. */
+static void
+ramdisk_write (void *aux, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multiple (aux, sector, 1, buffer);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    .read = ramdisk_read,
+    .write = ramdisk_write,
+    .read_multiple = ramdisk_read_multiple,
+    .write_multiple = ramdisk_write_multiple
+  };
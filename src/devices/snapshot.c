@@ -0,0 +1,270 @@
+#include "devices/snapshot.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Point-in-time snapshots of a block device.
+
+   A snapshot is a read-only block device that shows the
+   contents its "origin" device had when the snapshot was taken,
+   while the origin itself remains in use.  Before a write to the
+   origin changes a sector for the first time since the snapshot
+   was taken, the sector's old contents are copied to the next
+   unused sector of a "COW" (copy-on-write) device, and a remap
+   table records where they went.  Reads of the snapshot come
+   from the COW device for sectors in the remap table and from
+   the origin for the rest.
+
+   The origin thus always holds the live data by itself, so
+   dropping or losing a snapshot costs nothing.  The remap table
+   is kept only in memory, so a snapshot does not survive a
+   reboot.  If the COW device fills up, the snapshot becomes
+   invalid and may no longer be read. */
+
+/* Maximum number of sectors copied at a time. */
+#define COPY_CHUNK 8
+
+/* A snapshot. */
+struct snapshot
+  {
+    struct list_elem elem;              /* Element in all_snapshots. */
+    struct block *block;                /* The snapshot device. */
+    struct block *origin;               /* Device being snapshotted. */
+    struct block *cow;                  /* Holds copied sectors. */
+    struct hash remap;                  /* Origin sector -> COW sector. */
+    block_sector_t cow_used;            /* COW sectors in use. */
+    bool valid;                         /* False if COW overflowed. */
+    struct lock lock;                   /* Protects all of the above. */
+    uint8_t buffer[COPY_CHUNK * BLOCK_SECTOR_SIZE]; /* For copying. */
+  };
+
+/* A remap table entry. */
+struct remap
+  {
+    struct hash_elem elem;              /* Element in remap table. */
+    block_sector_t sector;              /* Sector on origin. */
+    block_sector_t cow_sector;          /* Copy of its old contents. */
+  };
+
+/* List of all snapshots. */
+static struct list all_snapshots = LIST_INITIALIZER (all_snapshots);
+
+static struct block_operations snapshot_operations;
+
+static hash_hash_func remap_hash;
+static hash_less_func remap_less;
+static void copy_out (void *snap_, block_sector_t, size_t cnt);
+static void free_remap (struct hash_elem *, void *aux);
+
+/* Takes a snapshot of ORIGIN, using COW to hold the old
+   contents of sectors written afterward, and returns the
+   snapshot device, named after ORIGIN with ".snap" appended.
+   Taking another snapshot of the same ORIGIN replaces the first
+   one, reusing its device, and forgets everything already on
+   COW.
+
+   Writes to ORIGIN that are in progress when the snapshot is
+   taken may or may not be part of the snapshot, so the snapshot
+   is consistent in the way that ORIGIN would be after a crash. */
+struct block *
+snapshot_create (struct block *origin, struct block *cow)
+{
+  struct snapshot *snap = NULL;
+  struct list_elem *e;
+  char name[16];
+
+  ASSERT (origin != cow);
+
+  for (e = list_begin (&all_snapshots); e != list_end (&all_snapshots);
+       e = list_next (e))
+    if (list_entry (e, struct snapshot, elem)->origin == origin)
+      snap = list_entry (e, struct snapshot, elem);
+
+  if (snap != NULL)
+    {
+      lock_acquire (&snap->lock);
+      hash_clear (&snap->remap, free_remap);
+      snap->cow = cow;
+      snap->cow_used = 0;
+      snap->valid = true;
+      lock_release (&snap->lock);
+      return snap->block;
+    }
+
+  snap = malloc (sizeof *snap);
+  if (snap == NULL || !hash_init (&snap->remap, remap_hash, remap_less, NULL))
+    PANIC ("snapshot creation failed");
+  snap->origin = origin;
+  snap->cow = cow;
+  snap->cow_used = 0;
+  snap->valid = true;
+  lock_init (&snap->lock);
+
+  snprintf (name, sizeof name, "%s.snap", block_name (origin));
+  snap->block = block_register (name, BLOCK_RAW, NULL, block_size (origin),
+                                &snapshot_operations, snap);
+  list_push_back (&all_snapshots, &snap->elem);
+  block_set_write_hook (origin, copy_out, snap);
+  return snap->block;
+}
+
+/* Returns the remap table entry for origin SECTOR in SNAP, or a
+   null pointer if SECTOR has not been written since the
+   snapshot was taken. */
+static struct remap *
+lookup (struct snapshot *snap, block_sector_t sector)
+{
+  struct remap key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&snap->remap, &key.elem);
+  return e != NULL ? hash_entry (e, struct remap, elem) : NULL;
+}
+
+/* Marks SNAP invalid, because REASON, and reports it. */
+static void
+invalidate (struct snapshot *snap, const char *reason)
+{
+  snap->valid = false;
+  printf ("%s: %s, snapshot invalidated\n", block_name (snap->block), reason);
+}
+
+/* Write hook for the origin of snapshot SNAP_: before CNT
+   sectors starting at SECTOR are written, copies the ones that
+   have not been copied yet to the COW device. */
+static void
+copy_out (void *snap_, block_sector_t sector, size_t cnt)
+{
+  struct snapshot *snap = snap_;
+
+  lock_acquire (&snap->lock);
+  while (cnt > 0 && snap->valid)
+    {
+      size_t run, i;
+
+      if (lookup (snap, sector) != NULL)
+        {
+          sector++;
+          cnt--;
+          continue;
+        }
+
+      /* Copy a run of not-yet-copied sectors. */
+      for (run = 1; run < cnt && run < COPY_CHUNK; run++)
+        if (lookup (snap, sector + run) != NULL)
+          break;
+      if (run > block_size (snap->cow) - snap->cow_used)
+        {
+          invalidate (snap, "out of COW space");
+          break;
+        }
+      block_read_multiple (snap->origin, sector, run, snap->buffer);
+      block_write_multiple (snap->cow, snap->cow_used, run, snap->buffer);
+
+      for (i = 0; i < run; i++)
+        {
+          struct remap *r = malloc (sizeof *r);
+          if (r == NULL)
+            {
+              invalidate (snap, "out of memory");
+              break;
+            }
+          r->sector = sector + i;
+          r->cow_sector = snap->cow_used + i;
+          hash_insert (&snap->remap, &r->elem);
+        }
+      snap->cow_used += run;
+      sector += run;
+      cnt -= run;
+    }
+  lock_release (&snap->lock);
+}
+
+/* Reads CNT sectors starting at SECTOR from snapshot SNAP_ into
+   BUFFER, as runs that are contiguous on the origin or on the
+   COW device. */
+static void
+snapshot_read_multiple (void *snap_, block_sector_t sector, size_t cnt,
+                        void *buffer_)
+{
+  struct snapshot *snap = snap_;
+  uint8_t *buffer = buffer_;
+
+  lock_acquire (&snap->lock);
+  if (!snap->valid)
+    PANIC ("%s: read from invalid snapshot", block_name (snap->block));
+  while (cnt > 0)
+    {
+      struct remap *r = lookup (snap, sector);
+      struct block *from = r != NULL ? snap->cow : snap->origin;
+      block_sector_t from_sector = r != NULL ? r->cow_sector : sector;
+      size_t run;
+
+      for (run = 1; run < cnt; run++)
+        {
+          struct remap *next = lookup (snap, sector + run);
+          if (r == NULL
+              ? next != NULL
+              : next == NULL || next->cow_sector != from_sector + run)
+            break;
+        }
+      block_read_multiple (from, from_sector, run, buffer);
+      sector += run;
+      cnt -= run;
+      buffer += run * BLOCK_SECTOR_SIZE;
+    }
+  lock_release (&snap->lock);
+}
+
+/* Reads SECTOR from snapshot SNAP into BUFFER. */
+static void
+snapshot_read (void *snap, block_sector_t sector, void *buffer)
+{
+  snapshot_read_multiple (snap, sector, 1, buffer);
+}
+
+/* Snapshots are read-only. */
+static void
+snapshot_write (void *snap_, block_sector_t sector UNUSED,
+                const void *buffer UNUSED)
+{
+  struct snapshot *snap = snap_;
+  PANIC ("%s: snapshots are read-only", block_name (snap->block));
+}
+
+static struct block_operations snapshot_operations =
+  {
+    .read = snapshot_read,
+    .write = snapshot_write,
+    .read_multiple = snapshot_read_multiple
+  };
+
+/* Returns a hash value for remap table entry E. */
+static unsigned
+remap_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct remap *r = hash_entry (e, struct remap, elem);
+  return hash_int (r->sector);
+}
+
+/* Returns true if remap table entry A precedes B. */
+static bool
+remap_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct remap *a = hash_entry (a_, struct remap, elem);
+  const struct remap *b = hash_entry (b_, struct remap, elem);
+  return a->sector < b->sector;
+}
+
+/* Frees remap table entry E. */
+static void
+free_remap (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct remap, elem));
+}
@@ -0,0 +1,8 @@
+#ifndef DEVICES_SNAPSHOT_H
+#define DEVICES_SNAPSHOT_H
+
+struct block;
+
+struct block *snapshot_create (struct block *origin, struct block *cow);
+
+#endif /* devices/snapshot.h */
@@ -141,7 +141,7 @@ timer_sleep (int64_t ticks)
   current->ticks_blocked = ticks;
   thread_block(); // block the current thread
   intr_set_level(old_level); // enable interrupts
-
+}
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
    turned on. */
@@ -230,7 +230,7 @@ timer_interrupt (struct intr_frame *args UNUSED)
   }
   intr_set_level(old_level);// enable interrupts
   thread_tick ();
-
+}
 
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
@@ -0,0 +1,106 @@
+/* nullcall.c
+
+   Measures the latency of a system call that does no work:
+   tell() on a file descriptor that is not open, which the
+   kernel rejects right after copying in the arguments.  Times
+   the calls with the CPU's time-stamp counter and prints the
+   average and the fastest, in cycles, for each way of entering
+   the kernel: "int $0x30", and SYSENTER if the CPU supports it.
+
+   Usage: nullcall [ITERATIONS] */
+
+#include <rdtsc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "../syscall-nr.h"
+
+/* Number of calls to make by default. */
+#define DEFAULT_ITERATIONS 100000
+
+/* Calls tell(FD) with "int $0x30". */
+static int
+tell_int (int fd)
+{
+  int retval;
+  asm volatile ("pushl %[fd]; pushl %[number]; int $0x30; addl $8, %%esp"
+                : "=a" (retval)
+                : [number] "i" (SYS_TELL), [fd] "g" (fd)
+                : "memory");
+  return retval;
+}
+
+/* Calls tell(FD) with SYSENTER. */
+static int
+tell_sysenter (int fd)
+{
+  int retval;
+  asm volatile ("pushl %[fd]; pushl %[number]; movl %%esp, %%ecx; "
+                "movl $1f, %%edx; sysenter; 1: addl $8, %%esp"
+                : "=a" (retval)
+                : [number] "i" (SYS_TELL), [fd] "g" (fd)
+                : "ecx", "edx", "memory");
+  return retval;
+}
+
+/* Returns true if the CPU supports SYSENTER.  Uses the same test
+   as the kernel, which sets SYSENTER up only if it passes. */
+static bool
+has_sysenter (void)
+{
+  unsigned eax, ebx, ecx, edx;
+  int family, model, stepping;
+
+  asm ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+  family = (eax >> 8) & 0xf;
+  model = (eax >> 4) & 0xf;
+  stepping = eax & 0xf;
+
+  /* Feature bit 11 is SEP, but early Pentium Pros set it without
+     supporting the instructions. */
+  return (edx & (1 << 11)) != 0
+         && !(family == 6 && model < 3 && stepping < 3);
+}
+
+/* Makes ITERATIONS calls to CALL and reports their latency,
+   labeled NAME. */
+static void
+measure (const char *name, int (*call) (int), int iterations)
+{
+  uint64_t best = UINT64_MAX;
+  uint64_t start, total;
+  int i;
+
+  start = rdtsc ();
+  for (i = 0; i < iterations; i++)
+    {
+      uint64_t t = rdtsc ();
+      call (-1);
+      t = rdtsc () - t;
+      if (t < best)
+        best = t;
+    }
+  total = rdtsc () - start;
+
+  printf ("nullcall: %s: %d calls, %llu cycles average, %llu cycles best\n",
+          name, iterations, total / iterations, best);
+}
+
+int
+main (int argc, char *argv[]) 
+{
+  int iterations = argc > 1 ? atoi (argv[1]) : DEFAULT_ITERATIONS;
+
+  if (iterations <= 0)
+    {
+      printf ("usage: nullcall [ITERATIONS]\n");
+      return EXIT_FAILURE;
+    }
+
+  measure ("int $0x30", tell_int, iterations);
+  if (has_sysenter ())
+    measure ("sysenter", tell_sysenter, iterations);
+  else
+    printf ("nullcall: sysenter: not supported by this CPU\n");
+  return EXIT_SUCCESS;
+}
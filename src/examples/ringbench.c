@@ -0,0 +1,125 @@
+/* ringbench.c
+
+   Compares plain read() and write() system calls with batched
+   submission through a ring.  Reads FILE, then writes the same
+   data back over it, SIZE bytes per operation, once with one
+   system call per operation and once with up to RING_ENTRIES
+   operations per ring_enter().  Prints the cycles each approach
+   takes, measured with the CPU's time-stamp counter.  The file's
+   contents are unchanged.
+
+   Usage: ringbench FILE [SIZE] */
+
+#include <rdtsc.h>
+#include <ring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+/* Default bytes per read or write. */
+#define DEFAULT_SIZE 512
+
+/* At most this much of the file is used. */
+#define BUFFER_SIZE (64 * 1024)
+
+static char buffer[BUFFER_SIZE];
+static struct ring ring;
+
+/* Reads or writes (as WRITING says) LENGTH bytes of FD at
+   buffer[], SIZE bytes per system call.  Returns false on a short
+   transfer. */
+static bool
+plain (int fd, bool writing, unsigned length, unsigned size)
+{
+  unsigned ofs;
+
+  seek (fd, 0);
+  for (ofs = 0; ofs < length; ofs += size)
+    {
+      unsigned chunk = length - ofs < size ? length - ofs : size;
+      int n = (writing
+               ? write (fd, buffer + ofs, chunk)
+               : read (fd, buffer + ofs, chunk));
+      if (n != (int) chunk)
+        return false;
+    }
+  return true;
+}
+
+/* Like plain(), but submits the operations through a ring in
+   batches. */
+static bool
+batched (int fd, bool writing, unsigned length, unsigned size)
+{
+  struct ring_cqe cqe;
+  unsigned ofs = 0;
+  bool success = true;
+
+  ring_init (&ring);
+  ring_prep_seek (&ring, fd, 0, 0);
+  while (ofs < length || ring_pending (&ring) > 0)
+    {
+      while (ofs < length)
+        {
+          unsigned chunk = length - ofs < size ? length - ofs : size;
+          if (writing
+              ? !ring_prep_write (&ring, fd, buffer + ofs, chunk, chunk)
+              : !ring_prep_read (&ring, fd, buffer + ofs, chunk, chunk))
+            break;
+          ofs += chunk;
+        }
+      ring_submit (&ring);
+      while (ring_reap (&ring, &cqe))
+        if (cqe.result != (int32_t) cqe.user_data)
+          success = false;
+    }
+  return success;
+}
+
+/* Runs FUNC on FD with the given arguments and prints how long
+   it took, labeled NAME. */
+static void
+measure (const char *name,
+         bool (*func) (int fd, bool writing, unsigned length, unsigned size),
+         int fd, bool writing, unsigned length, unsigned size)
+{
+  uint64_t start = rdtsc ();
+  bool success = func (fd, writing, length, size);
+  uint64_t cycles = rdtsc () - start;
+
+  printf ("ringbench: %-13s %5s: %6u bytes, %llu cycles%s\n",
+          name, writing ? "write" : "read", length, cycles,
+          success ? "" : " (short transfer)");
+}
+
+int
+main (int argc, char *argv[])
+{
+  unsigned size = argc > 2 ? atoi (argv[2]) : DEFAULT_SIZE;
+  unsigned length;
+  int fd;
+
+  if (argc < 2 || argc > 3 || size == 0)
+    {
+      printf ("usage: ringbench FILE [SIZE]\n");
+      return EXIT_FAILURE;
+    }
+
+  fd = open (argv[1]);
+  if (fd < 0)
+    {
+      printf ("%s: open failed\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  length = filesize (fd);
+  if (length > BUFFER_SIZE)
+    length = BUFFER_SIZE;
+
+  measure ("read/write", plain, fd, false, length, size);
+  measure ("ring_enter", batched, fd, false, length, size);
+  measure ("read/write", plain, fd, true, length, size);
+  measure ("ring_enter", batched, fd, true, length, size);
+
+  close (fd);
+  return EXIT_SUCCESS;
+}
@@ -37,6 +37,7 @@ dir_open (struct inode *inode)
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
     {
+      inode_mark_metadata (inode);
       dir->inode = inode;
       dir->pos = 0;
       return dir;
@@ -1,13 +1,42 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors of the free map file that have changed in memory since
+   they were last written, one bit per sector of the file.
+   Written back by free_map_flush(). */
+static struct bitmap *dirty_map;
+
+/* Number of free map bits stored in one sector of the free map
+   file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* The device is divided into allocation groups of GROUP_SECTORS
+   sectors each (the last group may be shorter).  Allocations
+   start in the group of their goal sector, so that related data
+   stays close together, and groups that are known to be too full
+   are skipped without scanning their bits. */
+#define GROUP_SECTORS 4096
+static size_t group_cnt;             /* Number of allocation groups. */
+static size_t *group_free;           /* Free sectors in each group. */
+
+static void mark_dirty (block_sector_t sector, size_t cnt);
+static void count_group_free (void);
+static void adjust_group_free (block_sector_t sector, size_t cnt,
+                               bool allocated);
+static block_sector_t scan_group (size_t group, block_sector_t from,
+                                  size_t cnt);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -15,38 +44,117 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                           BLOCK_SECTOR_SIZE));
+  if (dirty_map == NULL)
+    PANIC ("dirty map creation failed");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("allocation group table creation failed");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  count_group_free ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
+   The change reaches the disk at the next free_map_flush().
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* Allocates CNT consecutive sectors from the free map, as close
+   after GOAL as possible, and stores the first into *SECTORP.
+   Searches GOAL's allocation group first, then the following
+   groups in order, wrapping around, skipping groups with fewer
+   than CNT free sectors.  Runs too long to fit in one group fall
+   back to first fit from GOAL.
+   The change reaches the disk at the next free_map_flush().
+   Returns true if successful, false if not enough consecutive
+   sectors were available. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector = BITMAP_ERROR;
+  size_t first_group, i;
+
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  first_group = goal / GROUP_SECTORS;
+
+  for (i = 0; i < group_cnt && sector == BITMAP_ERROR; i++)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      size_t group = (first_group + i) % group_cnt;
+      if (group_free[group] >= cnt)
+        sector = scan_group (group, i == 0 ? goal : 0, cnt);
     }
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, goal, cnt, false);
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, 0, cnt, false);
+
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      adjust_group_free (sector, cnt, true);
+      mark_dirty (sector, cnt);
+      *sectorp = sector;
+    }
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use.
+   The change reaches the disk at the next free_map_flush(). */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  adjust_group_free (sector, cnt, false);
+  mark_dirty (sector, cnt);
+}
+
+/* Writes every dirty sector of the free map to disk, combining
+   runs of adjacent dirty sectors into a single write.
+   Returns true if successful, false if a write failed, in which
+   case the sectors that could not be written remain dirty. */
+bool
+free_map_flush (void)
+{
+  size_t dirty_cnt = bitmap_size (dirty_map);
+  size_t start = 0;
+  bool success = true;
+
+  if (free_map_file == NULL)
+    return true;
+
+  while ((start = bitmap_scan (dirty_map, start, 1, true)) != BITMAP_ERROR)
+    {
+      size_t end = bitmap_scan (dirty_map, start, 1, false);
+      size_t first_bit, last_bit;
+
+      if (end == BITMAP_ERROR)
+        end = dirty_cnt;
+      first_bit = start * BITS_PER_SECTOR;
+      last_bit = end * BITS_PER_SECTOR;
+      if (last_bit > bitmap_size (free_map))
+        last_bit = bitmap_size (free_map);
+
+      if (bitmap_write_part (free_map, free_map_file,
+                             first_bit, last_bit - first_bit))
+        bitmap_set_multiple (dirty_map, start, end - start, false);
+      else
+        success = false;
+      start = end;
+    }
+  return success;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,15 +164,23 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_mark_metadata (file_get_inode (free_map_file));
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty_map, false);
+  count_group_free ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  journal_begin ();
+  if (!free_map_flush ())
+    printf ("free map: write back failed\n");
+  journal_end ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -80,6 +196,81 @@ free_map_create (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_mark_metadata (file_get_inode (free_map_file));
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
+}
+
+/* Marks the free map file sectors that hold the bits for sectors
+   SECTOR through SECTOR + CNT - 1 as needing to be written. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first, last;
+
+  if (cnt == 0)
+    return;
+  first = sector / BITS_PER_SECTOR;
+  last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
+
+/* Recomputes the number of free sectors in each allocation
+   group from the free map. */
+static void
+count_group_free (void)
+{
+  size_t group;
+
+  for (group = 0; group < group_cnt; group++)
+    {
+      size_t start = group * GROUP_SECTORS;
+      size_t cnt = bitmap_size (free_map) - start;
+      if (cnt > GROUP_SECTORS)
+        cnt = GROUP_SECTORS;
+      group_free[group] = bitmap_count (free_map, start, cnt, false);
+    }
+}
+
+/* Updates the per-group free counts for CNT sectors starting at
+   SECTOR having just been ALLOCATED (if true) or released (if
+   false). */
+static void
+adjust_group_free (block_sector_t sector, size_t cnt, bool allocated)
+{
+  while (cnt > 0)
+    {
+      size_t group = sector / GROUP_SECTORS;
+      size_t group_end = (group + 1) * GROUP_SECTORS;
+      size_t chunk = group_end - sector < cnt ? group_end - sector : cnt;
+
+      if (allocated)
+        group_free[group] -= chunk;
+      else
+        group_free[group] += chunk;
+      sector += chunk;
+      cnt -= chunk;
+    }
+}
+
+/* Returns the first sector at or after FROM in allocation group
+   GROUP that begins CNT free sectors lying entirely within
+   GROUP, or BITMAP_ERROR if there is none. */
+static block_sector_t
+scan_group (size_t group, block_sector_t from, size_t cnt)
+{
+  size_t start = group * GROUP_SECTORS;
+  size_t end = start + GROUP_SECTORS;
+  size_t i;
+
+  if (end > bitmap_size (free_map))
+    end = bitmap_size (free_map);
+  if (from < start)
+    from = start;
+
+  for (i = from; i + cnt <= end; i++)
+    if (!bitmap_contains (free_map, i, cnt, true))
+      return i;
+  return BITMAP_ERROR;
 }
@@ -0,0 +1,173 @@
+#include "filesys/fsbench.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+
+/* File system benchmarks, run as kernel actions.  They are meant
+   to be run on a freshly formatted file system, e.g.:
+
+        pintos --filesys-size=64 -- -f -q bench-create 100
+
+   Each benchmark reports its cost in sectors transferred on the
+   file system device, as counted by the block layer. */
+
+/* Prints the quotient NUM / DENOM in fixed point with two
+   decimal places, followed by WHAT. */
+static void
+print_ratio (unsigned long long num, unsigned long long denom,
+             const char *what)
+{
+  unsigned long long hundredths = denom != 0 ? num * 100 / denom : 0;
+  printf ("%llu.%02llu %s", hundredths / 100, hundredths % 100, what);
+}
+
+/* Creates and removes an empty file ARGV[1] times and reports
+   the number of sectors written per create and per remove. */
+void
+fsbench_create (char **argv)
+{
+  int count = atoi (argv[1]);
+  unsigned long long create_writes = 0, remove_writes = 0;
+  int i;
+
+  if (count <= 0)
+    PANIC ("bench-create: bad count `%s'", argv[1]);
+
+  printf ("bench-create: creating and removing %d files on %s...\n",
+          count, block_name (fs_device));
+  for (i = 0; i < count; i++)
+    {
+      unsigned long long before;
+      char name[16];
+
+      snprintf (name, sizeof name, "bench%d", i);
+
+      before = block_write_cnt (fs_device);
+      if (!filesys_create (name, 0))
+        PANIC ("bench-create: %s: create failed", name);
+      create_writes += block_write_cnt (fs_device) - before;
+
+      before = block_write_cnt (fs_device);
+      if (!filesys_remove (name))
+        PANIC ("bench-create: %s: remove failed", name);
+      remove_writes += block_write_cnt (fs_device) - before;
+    }
+
+  printf ("bench-create: ");
+  print_ratio (create_writes, count, "sectors written per create, ");
+  print_ratio (remove_writes, count, "per remove\n");
+}
+
+/* Number of files created by fsbench_large_create(). */
+#define LARGE_CREATE_CNT 10
+
+/* Creates and removes a file ARGV[1] bytes long, like the
+   lg-create test does, LARGE_CREATE_CNT times, and reports the
+   time and the number of sectors written per create. */
+void
+fsbench_large_create (char **argv)
+{
+  int size = atoi (argv[1]);
+  unsigned long long writes = 0;
+  int64_t ticks = 0;
+  int i;
+
+  if (size < 0)
+    PANIC ("bench-lg-create: bad size `%s'", argv[1]);
+
+  printf ("bench-lg-create: creating %d files of %d bytes on %s...\n",
+          LARGE_CREATE_CNT, size, block_name (fs_device));
+  for (i = 0; i < LARGE_CREATE_CNT; i++)
+    {
+      unsigned long long before = block_write_cnt (fs_device);
+      int64_t start = timer_ticks ();
+
+      if (!filesys_create ("bench", size))
+        PANIC ("bench-lg-create: create failed");
+      ticks += timer_elapsed (start);
+      writes += block_write_cnt (fs_device) - before;
+
+      if (!filesys_remove ("bench"))
+        PANIC ("bench-lg-create: remove failed");
+    }
+
+  printf ("bench-lg-create: ");
+  print_ratio (ticks * 1000 / TIMER_FREQ, LARGE_CREATE_CNT,
+               "ms and ");
+  print_ratio (writes, LARGE_CREATE_CNT, "sectors written per create\n");
+}
+
+/* Size of each read or write done by fsbench_sequential(). */
+#define SEQ_CHUNK_SIZE (64 * 1024)
+
+/* Prints the throughput of transferring BYTES bytes in TICKS
+   timer ticks, labeled WHAT. */
+static void
+print_throughput (const char *what, off_t bytes, int64_t ticks)
+{
+  unsigned long long ms = ticks * 1000 / TIMER_FREQ;
+
+  printf ("bench-seq: %s %llu ms, ", what, ms);
+  if (ms > 0)
+    printf ("%llu kB/s\n", (unsigned long long) bytes * 1000 / 1024 / ms);
+  else
+    printf ("too fast to measure\n");
+}
+
+/* Writes a file ARGV[1] bytes long from start to end in
+   SEQ_CHUNK_SIZE pieces, then reads it back the same way, and
+   reports the throughput of each pass.  Compare runs before and
+   after a change to the block layer to measure its effect on
+   sequential I/O. */
+void
+fsbench_sequential (char **argv)
+{
+  int size = atoi (argv[1]);
+  struct file *file;
+  uint8_t *buffer;
+  int64_t start;
+  off_t ofs;
+
+  if (size <= 0)
+    PANIC ("bench-seq: bad size `%s'", argv[1]);
+
+  buffer = malloc (SEQ_CHUNK_SIZE);
+  if (buffer == NULL)
+    PANIC ("bench-seq: out of memory");
+  memset (buffer, 0x5a, SEQ_CHUNK_SIZE);
+  if (!filesys_create ("bench", size))
+    PANIC ("bench-seq: create failed");
+  file = filesys_open ("bench");
+  if (file == NULL)
+    PANIC ("bench-seq: open failed");
+
+  printf ("bench-seq: writing and reading %d bytes on %s...\n",
+          size, block_name (fs_device));
+  start = timer_ticks ();
+  for (ofs = 0; ofs < size; ofs += SEQ_CHUNK_SIZE)
+    {
+      off_t cnt = size - ofs < SEQ_CHUNK_SIZE ? size - ofs : SEQ_CHUNK_SIZE;
+      if (file_write_at (file, buffer, cnt, ofs) != cnt)
+        PANIC ("bench-seq: write failed at offset %d", (int) ofs);
+    }
+  print_throughput ("write", size, timer_elapsed (start));
+
+  start = timer_ticks ();
+  for (ofs = 0; ofs < size; ofs += SEQ_CHUNK_SIZE)
+    {
+      off_t cnt = size - ofs < SEQ_CHUNK_SIZE ? size - ofs : SEQ_CHUNK_SIZE;
+      if (file_read_at (file, buffer, cnt, ofs) != cnt)
+        PANIC ("bench-seq: read failed at offset %d", (int) ofs);
+    }
+  print_throughput ("read", size, timer_elapsed (start));
+
+  file_close (file);
+  filesys_remove ("bench");
+  free (buffer);
+}
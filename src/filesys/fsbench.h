@@ -0,0 +1,8 @@
+#ifndef FILESYS_FSBENCH_H
+#define FILESYS_FSBENCH_H
+
+void fsbench_create (char **argv);
+void fsbench_large_create (char **argv);
+void fsbench_sequential (char **argv);
+
+#endif /* filesys/fsbench.h */
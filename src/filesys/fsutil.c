@@ -1,12 +1,16 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "devices/snapshot.h"
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -67,20 +71,189 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Number of sectors in each of a stream's two buffers. */
+#define STREAM_SECTORS 64
+
+/* Sequential reading or writing of a block device through two
+   buffers, so that the device transfers one buffer while the
+   caller works on the other. */
+struct stream
+  {
+    struct block *block;                /* Device. */
+    bool write;                         /* Writing? (Otherwise reading.) */
+    block_sector_t next;                /* Sector stream_next() returns. */
+    block_sector_t sector;              /* Sector of next transfer. */
+    uint8_t *buffers[2];                /* STREAM_SECTORS sectors each. */
+    struct block_request reqs[2];       /* Transfers of BUFFERS. */
+    bool busy[2];                       /* Transfer in progress? */
+    size_t cnt[2];                      /* Sectors in each buffer. */
+    int cur;                            /* Buffer in use by caller. */
+    size_t pos;                         /* Sectors of CUR used. */
+  };
+
+/* Number of pages in a stream buffer. */
+#define STREAM_PAGES (STREAM_SECTORS * BLOCK_SECTOR_SIZE / PGSIZE)
+
+/* Starts a transfer of the CNT sectors starting at S's next
+   transfer sector to or from buffer I of S. */
+static void
+stream_transfer (struct stream *s, int i, size_t cnt)
+{
+  s->cnt[i] = cnt;
+  s->busy[i] = cnt > 0;
+  if (cnt > 0)
+    {
+      block_request_init (&s->reqs[i], s->write, s->sector, cnt,
+                          s->buffers[i], NULL, NULL);
+      block_submit (s->block, &s->reqs[i]);
+      s->sector += cnt;
+    }
+}
+
+/* Waits for the transfer of buffer I of S, if any, to finish. */
+static void
+stream_wait (struct stream *s, int i)
+{
+  if (s->busy[i])
+    {
+      block_request_wait (&s->reqs[i]);
+      s->busy[i] = false;
+    }
+}
+
+/* Starts reading the next buffer's worth of S's device into
+   buffer I of S, or marks buffer I empty at the end of the
+   device. */
+static void
+stream_fill (struct stream *s, int i)
+{
+  block_sector_t left = block_size (s->block) - s->sector;
+  stream_transfer (s, i, left < STREAM_SECTORS ? left : STREAM_SECTORS);
+}
+
+/* Initializes S to read (or, if WRITE is true, write) BLOCK
+   sequentially, starting at SECTOR.  A reading stream starts
+   reading both of its buffers right away. */
+static void
+stream_open (struct stream *s, struct block *block, bool write,
+             block_sector_t sector)
+{
+  int i;
+
+  s->block = block;
+  s->write = write;
+  s->next = s->sector = sector;
+  s->cur = 0;
+  s->pos = 0;
+  for (i = 0; i < 2; i++)
+    {
+      s->buffers[i] = palloc_get_multiple (PAL_ASSERT, STREAM_PAGES);
+      s->busy[i] = false;
+      s->cnt[i] = write ? STREAM_SECTORS : 0;
+      if (!write)
+        stream_fill (s, i);
+    }
+  stream_wait (s, 0);
+}
+
+/* Returns the next up to *CNT sectors of S, which must be more
+   than 0, and sets *CNT to the number actually returned, which
+   is at least 1.  For reading, returns a null pointer at the end
+   of the device.  For writing, the caller must fill in the
+   sectors before the next call; panics if the device is full.
+   The sectors remain valid only until the next call. */
+static uint8_t *
+stream_next (struct stream *s, size_t *cnt)
+{
+  uint8_t *p;
+
+  ASSERT (*cnt > 0);
+  if (s->pos == s->cnt[s->cur])
+    {
+      /* Current buffer used up.  Pass it to the device and
+         switch to the other one. */
+      if (s->write)
+        stream_transfer (s, s->cur, s->pos);
+      else
+        stream_fill (s, s->cur);
+      s->cur = !s->cur;
+      s->pos = 0;
+      stream_wait (s, s->cur);
+      if (s->write)
+        s->cnt[s->cur] = STREAM_SECTORS;
+      else if (s->cnt[s->cur] == 0)
+        return NULL;
+    }
+
+  if (*cnt > s->cnt[s->cur] - s->pos)
+    *cnt = s->cnt[s->cur] - s->pos;
+  if (s->write && *cnt > block_size (s->block) - s->next)
+    {
+      if (s->next >= block_size (s->block))
+        PANIC ("%s: out of space", block_name (s->block));
+      *cnt = block_size (s->block) - s->next;
+    }
+  p = s->buffers[s->cur] + s->pos * BLOCK_SECTOR_SIZE;
+  s->pos += *cnt;
+  s->next += *cnt;
+  return p;
+}
+
+/* Finishes with S: writes out any sectors still buffered, waits
+   for all transfers, and frees S's buffers. */
+static void
+stream_close (struct stream *s)
+{
+  int i;
+
+  if (s->write && s->pos > 0)
+    stream_transfer (s, s->cur, s->pos);
+  for (i = 0; i < 2; i++)
+    {
+      stream_wait (s, i);
+      palloc_free_multiple (s->buffers[i], STREAM_PAGES);
+    }
+}
+
+/* Prints how long it took to transfer BYTES bytes of FILE_CNT
+   files in TICKS timer ticks, labeled WHAT. */
+static void
+print_transfer_stats (const char *what, int file_cnt, unsigned long long bytes,
+                      int64_t ticks)
+{
+  unsigned long long ms = ticks * 1000 / TIMER_FREQ;
+
+  printf ("%s %d files, %llu bytes in %llu ms", what, file_cnt, bytes, ms);
+  if (ms > 0)
+    printf (" (%llu kB/s)\n", bytes * 1000 / 1024 / ms);
+  else
+    printf ("\n");
+}
+
 /* Extracts a ustar-format tar archive from the scratch block
-   device into the Pintos file system. */
+   device into the Pintos file system.
+
+   The archive is read through a stream, so that the scratch
+   device reads ahead while headers are parsed and file data is
+   written, and each file_write() call writes as much of a file
+   as one stream buffer holds. */
 void
 fsutil_extract (char **argv UNUSED) 
 {
   static block_sector_t sector = 0;
 
   struct block *src;
-  void *header, *data;
+  struct stream stream;
+  char *header;
+  int64_t start = timer_ticks ();
+  unsigned long long bytes = 0;
+  int file_cnt = 0;
 
-  /* Allocate buffers. */
+  /* Allocate header buffer.  Headers are copied out of the
+     stream because the file name must outlive the stream
+     buffer. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
-  if (header == NULL || data == NULL)
+  if (header == NULL)
     PANIC ("couldn't allocate buffers");
 
   /* Open source block device. */
@@ -91,18 +264,25 @@ fsutil_extract (char **argv UNUSED)
   printf ("Extracting ustar archive from scratch device "
           "into file system...\n");
 
+  stream_open (&stream, src, false, sector);
   for (;;)
     {
       const char *file_name;
       const char *error;
       enum ustar_type type;
+      uint8_t *data;
+      size_t cnt = 1;
       int size;
 
       /* Read and parse ustar header. */
-      block_read (src, sector++, header);
+      data = stream_next (&stream, &cnt);
+      if (data == NULL)
+        PANIC ("ustar archive runs past end of scratch device");
+      memcpy (header, data, BLOCK_SECTOR_SIZE);
       error = ustar_parse_header (header, &file_name, &type, &size);
       if (error != NULL)
-        PANIC ("bad ustar header in sector %"PRDSNu" (%s)", sector - 1, error);
+        PANIC ("bad ustar header in sector %"PRDSNu" (%s)",
+               stream.next - 1, error);
 
       if (type == USTAR_EOF)
         {
@@ -124,13 +304,21 @@ fsutil_extract (char **argv UNUSED)
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
 
-          /* Do copy. */
+          /* Do copy, as many sectors at a time as the stream
+             allows. */
+          file_cnt++;
+          bytes += size;
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
-                                : size);
-              block_read (src, sector++, data);
+              int chunk_size;
+
+              cnt = DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+              data = stream_next (&stream, &cnt);
+              if (data == NULL)
+                PANIC ("%s: archive truncated", file_name);
+              chunk_size = (size > (int) (cnt * BLOCK_SECTOR_SIZE)
+                            ? (int) (cnt * BLOCK_SECTOR_SIZE)
+                            : size);
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
@@ -141,6 +329,9 @@ fsutil_extract (char **argv UNUSED)
           file_close (dst);
         }
     }
+  sector = stream.next;
+  stream_close (&stream);
+  print_transfer_stats ("Extracted", file_cnt, bytes, timer_elapsed (start));
 
   /* Erase the ustar header from the start of the block device,
      so that the extraction operation is idempotent.  We erase
@@ -151,12 +342,12 @@ fsutil_extract (char **argv UNUSED)
   block_write (src, 0, header);
   block_write (src, 1, header);
 
-  free (data);
   free (header);
 }
 
 /* Copies file FILE_NAME from the file system to the scratch
-   device, in ustar format.
+   device, in ustar format, through a stream, so that file reads
+   overlap with writes to the scratch device.
 
    The first call to this function will write starting at the
    beginning of the scratch device.  Later calls advance across
@@ -169,18 +360,16 @@ fsutil_append (char **argv)
   static block_sector_t sector = 0;
 
   const char *file_name = argv[1];
-  void *buffer;
+  struct stream stream;
   struct file *src;
   struct block *dst;
+  uint8_t *data;
+  size_t cnt;
   off_t size;
+  int64_t start = timer_ticks ();
 
   printf ("Appending '%s' to ustar archive on scratch device...\n", file_name);
 
-  /* Allocate buffer. */
-  buffer = malloc (BLOCK_SECTOR_SIZE);
-  if (buffer == NULL)
-    PANIC ("couldn't allocate buffer");
-
   /* Open source file. */
   src = filesys_open (file_name);
   if (src == NULL)
@@ -191,33 +380,106 @@ fsutil_append (char **argv)
   dst = block_get_role (BLOCK_SCRATCH);
   if (dst == NULL)
     PANIC ("couldn't open scratch device");
+  stream_open (&stream, dst, true, sector);
   
   /* Write ustar header to first sector. */
-  if (!ustar_make_header (file_name, USTAR_REGULAR, size, buffer))
+  cnt = 1;
+  data = stream_next (&stream, &cnt);
+  if (!ustar_make_header (file_name, USTAR_REGULAR, size, (char *) data))
     PANIC ("%s: name too long for ustar format", file_name);
-  block_write (dst, sector++, buffer);
 
-  /* Do copy. */
+  /* Do copy, as many sectors at a time as the stream allows. */
   while (size > 0) 
     {
-      int chunk_size = size > BLOCK_SECTOR_SIZE ? BLOCK_SECTOR_SIZE : size;
-      if (sector >= block_size (dst))
-        PANIC ("%s: out of space on scratch device", file_name);
-      if (file_read (src, buffer, chunk_size) != chunk_size)
+      off_t chunk_size;
+
+      cnt = DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+      data = stream_next (&stream, &cnt);
+      chunk_size = (size > (off_t) (cnt * BLOCK_SECTOR_SIZE)
+                    ? (off_t) (cnt * BLOCK_SECTOR_SIZE)
+                    : size);
+      if (file_read (src, data, chunk_size) != chunk_size)
         PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-      memset (buffer + chunk_size, 0, BLOCK_SECTOR_SIZE - chunk_size);
-      block_write (dst, sector++, buffer);
+      memset (data + chunk_size, 0, cnt * BLOCK_SECTOR_SIZE - chunk_size);
       size -= chunk_size;
     }
 
   /* Write ustar end-of-archive marker, which is two consecutive
      sectors full of zeros.  Don't advance our position past
      them, though, in case we have more files to append. */
-  memset (buffer, 0, BLOCK_SECTOR_SIZE);
-  block_write (dst, sector, buffer);
-  block_write (dst, sector, buffer + 1);
+  sector = stream.next;
+  for (cnt = 0; cnt < 2; )
+    {
+      size_t zero_cnt = 2 - cnt;
+      data = stream_next (&stream, &zero_cnt);
+      memset (data, 0, zero_cnt * BLOCK_SECTOR_SIZE);
+      cnt += zero_cnt;
+    }
+  stream_close (&stream);
+  print_transfer_stats ("Appended", 1, file_length (src),
+                        timer_elapsed (start));
 
   /* Finish up. */
   file_close (src);
-  free (buffer);
+}
+
+/* Most recent snapshot of the file system device, if any. */
+static struct block *snapshot;
+
+/* Takes a snapshot of the file system device, using block
+   device ARGV[1] to preserve sectors that change afterward.  The
+   snapshot is registered as a read-only block device, which
+   `snapshot-copy' can save elsewhere while the file system
+   remains in use. */
+void
+fsutil_snapshot (char **argv)
+{
+  const char *cow_name = argv[1];
+  struct block *cow;
+
+  cow = block_get_by_name (cow_name);
+  if (cow == NULL)
+    PANIC ("%s: no such block device", cow_name);
+  if (cow == fs_device)
+    PANIC ("%s: can't keep a snapshot of itself", cow_name);
+
+  /* Commit recent metadata changes, so that they are part of the
+     snapshot. */
+  journal_sync ();
+  snapshot = snapshot_create (fs_device, cow);
+  printf ("Took snapshot %s of %s, using %s for changes.\n",
+          block_name (snapshot), block_name (fs_device), cow_name);
+}
+
+/* Copies the most recent snapshot of the file system device to
+   block device ARGV[1], which must be at least as large. */
+void
+fsutil_snapshot_copy (char **argv)
+{
+  const char *dst_name = argv[1];
+  block_sector_t size, sector;
+  struct block *dst;
+  void *buffer;
+
+  if (snapshot == NULL)
+    PANIC ("no snapshot to copy");
+  dst = block_get_by_name (dst_name);
+  if (dst == NULL)
+    PANIC ("%s: no such block device", dst_name);
+  size = block_size (snapshot);
+  if (block_size (dst) < size)
+    PANIC ("%s: too small to hold %s", dst_name, block_name (snapshot));
+
+  printf ("Copying snapshot %s to %s...\n", block_name (snapshot), dst_name);
+  buffer = palloc_get_page (PAL_ASSERT);
+  for (sector = 0; sector < size; )
+    {
+      size_t cnt = size - sector;
+      if (cnt > PGSIZE / BLOCK_SECTOR_SIZE)
+        cnt = PGSIZE / BLOCK_SECTOR_SIZE;
+      block_read_multiple (snapshot, sector, cnt, buffer);
+      block_write_multiple (dst, sector, cnt, buffer);
+      sector += cnt;
+    }
+  palloc_free_page (buffer);
 }
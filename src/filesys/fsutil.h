@@ -6,5 +6,7 @@ void fsutil_cat (char **argv);
 void fsutil_rm (char **argv);
 void fsutil_extract (char **argv);
 void fsutil_append (char **argv);
+void fsutil_snapshot (char **argv);
+void fsutil_snapshot_copy (char **argv);
 
 #endif /* filesys/fsutil.h */
@@ -1,23 +1,42 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of words in an inode's written map. */
+#define WRITTEN_WORDS 121
+
+/* Number of bits in an inode's written map. */
+#define WRITTEN_BITS (WRITTEN_WORDS * 32)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Data sectors are not zeroed when a file is created.  Instead,
+   the file's sectors are divided into at most WRITTEN_BITS
+   chunks of CHUNK_SECTORS sectors each, and WRITTEN has a 1-bit
+   for each chunk that has ever been written.  Reads from chunks
+   that have never been written return zeros without touching
+   the disk.  A CHUNK_SECTORS of 0, as in inodes that predate the
+   written map, means that every chunk counts as written. */
 struct inode_disk
   {
     block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t chunk_sectors;             /* Sectors per written bit. */
+    uint32_t written[WRITTEN_WORDS];    /* Chunks written, 1 bit each. */
+    uint32_t unused[3];                 /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,14 +47,21 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Maximum number of closed inodes kept in memory so that
+   reopening them does not have to read the disk again.
+   Set to 0 to free inodes as soon as they are closed. */
+#define INODE_CACHE_CNT 32
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in open_inodes. */
+    struct list_elem lru_elem;          /* Element in closed_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    bool metadata;                      /* Journal writes to data? */
     struct inode_disk data;             /* Inode content. */
   };
 
@@ -53,15 +79,152 @@ byte_to_sector (const struct inode *inode, off_t pos)
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns true if data sector SECTOR_IDX, counted from the
+   start of INODE's data, has ever been written. */
+static bool
+sector_written (const struct inode *inode, size_t sector_idx)
+{
+  size_t chunk;
+
+  if (inode->data.chunk_sectors == 0)
+    return true;
+  chunk = sector_idx / inode->data.chunk_sectors;
+  return (inode->data.written[chunk / 32] >> (chunk % 32)) & 1;
+}
+
+static void inode_write_sector (struct inode *, block_sector_t,
+                                const void *);
+
+/* Returns the number of whole sectors in INODE starting at
+   sector-aligned byte OFFSET that lie within the next SIZE bytes
+   and before end of file. */
+static size_t
+full_sectors (const struct inode *inode, off_t offset, off_t size)
+{
+  off_t inode_left = inode->data.length - offset;
+  off_t left = size < inode_left ? size : inode_left;
+
+  ASSERT (offset % BLOCK_SECTOR_SIZE == 0);
+  return left > 0 ? left / BLOCK_SECTOR_SIZE : 0;
+}
+
+/* Prepares CNT data sectors starting at SECTOR_IDX, counted from
+   the start of INODE's data, to be written.  For each of their
+   chunks that has never been written, zeros the chunk's sectors
+   outside the range on disk and marks the chunk written.  If the
+   written map changes, the inode is logged along with it, so the
+   caller must be inside a transaction. */
+static void
+prepare_sector_write (struct inode *inode, size_t sector_idx, size_t cnt)
+{
+  size_t chunk_sectors = inode->data.chunk_sectors;
+  size_t total = bytes_to_sectors (inode->data.length);
+  bool changed = false;
+  size_t chunk;
+
+  if (chunk_sectors == 0)
+    return;
+
+  for (chunk = sector_idx / chunk_sectors;
+       chunk <= (sector_idx + cnt - 1) / chunk_sectors; chunk++)
+    {
+      if (sector_written (inode, chunk * chunk_sectors))
+        continue;
+
+      if (chunk_sectors > 1)
+        {
+          static char zeros[BLOCK_SECTOR_SIZE];
+          size_t first = chunk * chunk_sectors;
+          size_t last = first + chunk_sectors;
+          size_t i;
+
+          if (last > total)
+            last = total;
+          for (i = first; i < last; i++)
+            if (i < sector_idx || i >= sector_idx + cnt)
+              inode_write_sector (inode, inode->data.start + i, zeros);
+        }
+      inode->data.written[chunk / 32] |= 1u << (chunk % 32);
+      changed = true;
+    }
+  if (changed)
+    journal_write (inode->sector, &inode->data);
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  Also contains the
+   inodes in closed_inodes. */
+static struct hash open_inodes;
+
+/* Inodes whose open_cnt has dropped to 0 but that are kept in
+   memory anyway, least recently closed first.  At most
+   INODE_CACHE_CNT long. */
+static struct list closed_inodes;
+static size_t closed_inode_cnt;
+
+/* Protects open_inodes, closed_inodes, and every inode's
+   open_cnt. */
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+static void inode_free (struct inode *);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
+  closed_inode_cnt = 0;
+  lock_init (&open_inodes_lock);
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, hash_elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, hash_elem);
+  const struct inode *b = hash_entry (b_, struct inode, hash_elem);
+  return a->sector < b->sector;
+}
+
+/* Returns the in-memory inode for SECTOR, or a null pointer if
+   there is none.  The caller must hold open_inodes_lock. */
+static struct inode *
+inode_lookup (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&open_inodes_lock));
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct inode, hash_elem) : NULL;
+}
+
+/* Removes INODE, which must be closed, from the closed inode
+   cache and from open_inodes, and frees it.  The caller must
+   hold open_inodes_lock. */
+static void
+inode_free (struct inode *inode)
+{
+  ASSERT (inode->open_cnt == 0);
+
+  list_remove (&inode->lru_elem);
+  closed_inode_cnt--;
+  hash_delete (&open_inodes, &inode->hash_elem);
+  free (inode);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -85,19 +248,30 @@ inode_create (block_sector_t sector, off_t length)
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+      struct inode *stale;
+
+      /* Drop any cached copy of an inode that used to live in
+         SECTOR. */
+      lock_acquire (&open_inodes_lock);
+      stale = inode_lookup (sector);
+      if (stale != NULL)
+        {
+          ASSERT (stale->open_cnt == 0);
+          inode_free (stale);
+        }
+      lock_release (&open_inodes_lock);
+
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->chunk_sectors = (sectors > WRITTEN_BITS
+                                   ? DIV_ROUND_UP (sectors, WRITTEN_BITS)
+                                   : 1);
+      if (free_map_allocate_near (sector + 1, sectors, &disk_inode->start)) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          /* The data sectors are not zeroed here: the written map
+             is all zeros, so reads return zeros until real data
+             arrives. */
+          journal_write (sector, disk_inode);
           success = true; 
         } 
       free (disk_inode);
@@ -111,33 +285,42 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+
+  /* Check whether this inode is already open or cached. */
+  inode = inode_lookup (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      if (inode->open_cnt++ == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->lru_elem);
+          closed_inode_cnt--;
         }
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The disk read happens with the lock held so
+     that a concurrent opener of the same sector waits for it
+     instead of reading the sector a second time. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->metadata = false;
+  journal_read (inode->sector, &inode->data);
+  hash_insert (&open_inodes, &inode->hash_elem);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +329,12 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      ASSERT (inode->open_cnt > 0);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -158,8 +346,11 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, moves it to the
+   closed inode cache, evicting the least recently closed inode
+   if the cache is full.
+   If INODE was also a removed inode, frees its memory and its
+   blocks instead. */
 void
 inode_close (struct inode *inode) 
 {
@@ -167,22 +358,35 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          /* Remove from inode table and deallocate blocks. */
+          hash_delete (&open_inodes, &inode->hash_elem);
+          journal_begin ();
           free_map_release (inode->sector, 1);
           free_map_release (inode->data.start,
                             bytes_to_sectors (inode->data.length)); 
+          free_map_flush ();
+          journal_end ();
+          free (inode); 
+        }
+      else
+        {
+          /* Keep it around in case it is reopened soon. */
+          list_push_back (&closed_inodes, &inode->lru_elem);
+          closed_inode_cnt++;
+          if (closed_inode_cnt > INODE_CACHE_CNT)
+            inode_free (list_entry (list_front (&closed_inodes),
+                                    struct inode, lru_elem));
         }
-
-      free (inode); 
     }
+
+  lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -220,10 +424,23 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (!sector_written (inode, offset / BLOCK_SECTOR_SIZE))
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Never written, so it reads as zeros. */
+          memset (buffer + bytes_read, 0, chunk_size);
+        }
+      else if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+        {
+          /* Read full sectors directly into caller's buffer, as
+             many written ones in a row as possible at once. */
+          size_t first = offset / BLOCK_SECTOR_SIZE;
+          size_t max = full_sectors (inode, offset, size);
+          size_t cnt = 1;
+
+          while (cnt < max && sector_written (inode, first + cnt))
+            cnt++;
+          journal_read_multiple (sector_idx, cnt, buffer + bytes_read);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
       else 
         {
@@ -235,7 +452,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
               if (bounce == NULL)
                 break;
             }
-          block_read (fs_device, sector_idx, bounce);
+          journal_read (sector_idx, bounce);
           memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         }
       
@@ -249,6 +466,18 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   return bytes_read;
 }
 
+/* Writes BUFFER to data sector SECTOR of INODE, through the
+   journal if INODE holds file system metadata. */
+static void
+inode_write_sector (struct inode *inode, block_sector_t sector,
+                    const void *buffer)
+{
+  if (inode->metadata)
+    journal_write (sector, buffer);
+  else
+    journal_write_through (sector, buffer);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
@@ -265,6 +494,9 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   if (inode->deny_write_cnt)
     return 0;
 
+  /* Chunks written for the first time are marked in the written
+     map in the same transaction as the writes themselves. */
+  journal_begin ();
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
@@ -278,13 +510,31 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
       /* Number of bytes to actually write into this sector. */
       int chunk_size = size < min_left ? size : min_left;
+      size_t cnt = 1;
+      bool was_written;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* File data, unlike metadata, can go to disk in runs of
+         full sectors. */
+      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE
+          && !inode->metadata)
+        cnt = full_sectors (inode, offset, size);
+
+      was_written = sector_written (inode, offset / BLOCK_SECTOR_SIZE);
+      prepare_sector_write (inode, offset / BLOCK_SECTOR_SIZE, cnt);
+
+      if (cnt > 1)
+        {
+          /* Write full sectors directly to disk at once. */
+          journal_write_through_multiple (sector_idx, cnt,
+                                          buffer + bytes_written);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
+        }
+      else if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
           /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          inode_write_sector (inode, sector_idx, buffer + bytes_written);
         }
       else 
         {
@@ -298,13 +548,14 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
           /* If the sector contains data before or after the chunk
              we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
+             first.  Otherwise, or if the sector has never been
+             written, we start with a sector of all zeros. */
+          if (was_written && (sector_ofs > 0 || chunk_size < sector_left)) 
+            journal_read (sector_idx, bounce);
           else
             memset (bounce, 0, BLOCK_SECTOR_SIZE);
           memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          inode_write_sector (inode, sector_idx, bounce);
         }
 
       /* Advance. */
@@ -312,6 +563,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
+  journal_end ();
   free (bounce);
 
   return bytes_written;
@@ -337,6 +589,15 @@ inode_allow_write (struct inode *inode)
   inode->deny_write_cnt--;
 }
 
+/* Marks INODE as holding file system metadata, such as a
+   directory or the free map, so that writes to its data are
+   journaled. */
+void
+inode_mark_metadata (struct inode *inode)
+{
+  inode->metadata = true;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
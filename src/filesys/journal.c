@@ -0,0 +1,524 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A redo journal for file system metadata.
+
+   Metadata writes (inodes, directories, the free map) made
+   between journal_begin() and journal_end() are not written to
+   their home sectors right away.  Instead they are kept in
+   memory as "pending" blocks, and reads of those sectors are
+   satisfied from memory.  Once no transaction is in progress and
+   enough blocks have piled up, all of the pending blocks are
+   committed together: they are written sequentially to the
+   journal area, followed by a header sector listing their home
+   sectors.  Later, usually after several commits, a checkpoint
+   writes the pending blocks to their home sectors in sector
+   order and marks the journal empty.
+
+   The journal area consists of two slots of JOURNAL_SLOT_SECTORS
+   sectors, each a header followed by space for logged blocks.
+   Every header write goes to the slot other than the one with
+   the newest header, with the next sequence number, so that a
+   crash in the middle of writing a slot leaves the other slot's
+   header, which describes intact data, as the newest one.  At
+   startup, journal_init() replays the newest slot if its header
+   lists any blocks.
+
+   Pending blocks of a transaction cannot be committed before the
+   transaction ends, so the journal must never fill up while a
+   transaction is open.  Each transaction therefore reserves room
+   for JOURNAL_TXN_BLOCKS new pending blocks when it begins, and
+   waits for room, checkpointing if necessary, if there is not
+   enough. */
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Sectors in each of the two journal slots. */
+#define JOURNAL_SLOT_SECTORS (JOURNAL_SECTORS / 2)
+
+/* Maximum number of pending blocks. */
+#define JOURNAL_MAX_BLOCKS (JOURNAL_SLOT_SECTORS - 1)
+
+/* Commit once this many blocks have changed since the last
+   commit... */
+#define JOURNAL_GROUP_CNT 16
+
+/* ...and checkpoint once this many blocks are pending. */
+#define JOURNAL_CHECKPOINT_CNT (JOURNAL_MAX_BLOCKS / 2)
+
+/* Most pending blocks that a single transaction may add.  The
+   largest transactions, creating or removing a file, touch a few
+   free map sectors, an inode, and a directory sector and its
+   inode. */
+#define JOURNAL_TXN_BLOCKS 16
+
+/* On-disk journal header.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Sequence number. */
+    uint32_t block_cnt;                 /* Number of logged blocks. */
+    block_sector_t sectors[JOURNAL_MAX_BLOCKS]; /* Their home sectors. */
+    uint32_t unused[125 - JOURNAL_MAX_BLOCKS];  /* Not used. */
+  };
+
+/* A metadata block that has not yet been written to its home
+   sector. */
+struct journal_block
+  {
+    block_sector_t sector;              /* Home sector. */
+    bool logged;                        /* Unchanged since last commit? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Contents. */
+  };
+
+static struct lock journal_lock;        /* Protects everything below. */
+static bool journal_active;             /* Journal in use? */
+static int txn_cnt;                     /* Transactions in progress. */
+static struct condition room_cond;      /* Signaled when txn_cnt drops
+                                           to 0. */
+static struct journal_block *blocks;    /* Pending blocks. */
+static size_t block_cnt;                /* Number of pending blocks. */
+static size_t unlogged_cnt;             /* Pending blocks not logged. */
+static uint32_t journal_seq;            /* Newest header's sequence. */
+static int journal_slot;                /* Newest header's slot. */
+
+static struct journal_block *find_block (block_sector_t);
+static void write_header (size_t cnt, const block_sector_t *sectors);
+static void commit (void);
+static void checkpoint (void);
+static void replay (void);
+
+/* Returns the first sector of journal slot SLOT. */
+static block_sector_t
+slot_start (int slot)
+{
+  return JOURNAL_SECTOR + slot * JOURNAL_SLOT_SECTORS;
+}
+
+/* Writes empty headers to both journal slots.  Used when
+   formatting the file system, before journal_init(). */
+void
+journal_create (void)
+{
+  struct journal_header *h;
+  int slot;
+
+  ASSERT (sizeof *h == BLOCK_SECTOR_SIZE);
+  ASSERT (!journal_active);
+
+  h = calloc (1, sizeof *h);
+  if (h == NULL)
+    PANIC ("journal creation failed");
+  h->magic = JOURNAL_MAGIC;
+  for (slot = 0; slot < 2; slot++)
+    {
+      h->seq = slot;
+      block_write (fs_device, slot_start (slot), h);
+    }
+  free (h);
+}
+
+/* Initializes the journal, replaying any committed transactions
+   that were not yet checkpointed when the file system was last
+   in use.  Afterward, metadata writes go through the journal. */
+void
+journal_init (void)
+{
+  lock_init (&journal_lock);
+  cond_init (&room_cond);
+  blocks = malloc (JOURNAL_MAX_BLOCKS * sizeof *blocks);
+  if (blocks == NULL)
+    PANIC ("journal initialization failed");
+  block_cnt = unlogged_cnt = 0;
+  txn_cnt = 0;
+
+  replay ();
+  journal_active = true;
+}
+
+/* Commits and checkpoints all pending blocks and stops using
+   the journal.  Metadata writes afterward go straight to disk. */
+void
+journal_done (void)
+{
+  if (!journal_active)
+    return;
+
+  lock_acquire (&journal_lock);
+  ASSERT (txn_cnt == 0);
+  checkpoint ();
+  journal_active = false;
+  lock_release (&journal_lock);
+  free (blocks);
+}
+
+/* Commits all pending blocks, if no transaction is in progress,
+   so that the file system device and its journal alone describe
+   the file system's current state.  Otherwise, the blocks will
+   be committed once the transactions in progress end. */
+void
+journal_sync (void)
+{
+  if (!journal_active)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (txn_cnt == 0)
+    commit ();
+  lock_release (&journal_lock);
+}
+
+/* Starts a transaction.  The metadata writes made before the
+   matching journal_end() reach the disk atomically: after a
+   crash, either all of them or none of them are visible.
+   Transactions may nest, in which case the inner ones are part
+   of the outermost one, and may overlap with transactions in
+   other threads, in which case they commit together.  Starting
+   an outermost transaction may have to wait until the
+   transactions in other threads end, if the journal does not
+   have room for another one. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!journal_active)
+    return;
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (block_cnt + (txn_cnt + 1) * JOURNAL_TXN_BLOCKS
+         > JOURNAL_MAX_BLOCKS)
+    {
+      if (txn_cnt == 0)
+        checkpoint ();
+      else
+        cond_wait (&room_cond, &journal_lock);
+    }
+  txn_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Ends a transaction started by journal_begin().  If this was
+   the last transaction in progress and enough metadata has
+   changed, commits it, along with any other pending changes. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!journal_active)
+    return;
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  ASSERT (txn_cnt > 0);
+  if (--txn_cnt == 0)
+    {
+      if (unlogged_cnt >= JOURNAL_GROUP_CNT)
+        {
+          commit ();
+          if (block_cnt >= JOURNAL_CHECKPOINT_CNT)
+            checkpoint ();
+        }
+      cond_broadcast (&room_cond, &journal_lock);
+    }
+  lock_release (&journal_lock);
+}
+
+/* Reads SECTOR of the file system device into BUFFER, taking
+   pending metadata writes into account. */
+void
+journal_read (block_sector_t sector, void *buffer)
+{
+  if (journal_active)
+    {
+      struct journal_block *b;
+
+      lock_acquire (&journal_lock);
+      b = find_block (sector);
+      if (b != NULL)
+        memcpy (buffer, b->data, BLOCK_SECTOR_SIZE);
+      lock_release (&journal_lock);
+      if (b != NULL)
+        return;
+    }
+  block_read (fs_device, sector, buffer);
+}
+
+/* Writes BUFFER to metadata SECTOR of the file system device as
+   part of the current transaction.  A write outside any
+   transaction forms a transaction by itself. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  struct journal_block *b;
+
+  if (!journal_active)
+    {
+      block_write (fs_device, sector, buffer);
+      return;
+    }
+
+  journal_begin ();
+  lock_acquire (&journal_lock);
+  b = find_block (sector);
+  if (b == NULL)
+    {
+      /* The reservation made by journal_begin() guarantees room,
+         unless a transaction wrote more than JOURNAL_TXN_BLOCKS
+         blocks. */
+      ASSERT (block_cnt < JOURNAL_MAX_BLOCKS);
+      b = &blocks[block_cnt++];
+      b->sector = sector;
+      b->logged = true;
+    }
+
+  memcpy (b->data, buffer, BLOCK_SECTOR_SIZE);
+  if (b->logged)
+    {
+      b->logged = false;
+      unlogged_cnt++;
+    }
+  lock_release (&journal_lock);
+  journal_end ();
+}
+
+/* Writes BUFFER to file data SECTOR of the file system device.
+   Usually this writes to disk directly, but if SECTOR was
+   recently metadata and its old contents are still pending, the
+   pending copy is updated instead so that a later checkpoint
+   does not overwrite the new data. */
+void
+journal_write_through (block_sector_t sector, const void *buffer)
+{
+  if (journal_active)
+    {
+      struct journal_block *b;
+
+      lock_acquire (&journal_lock);
+      b = find_block (sector);
+      if (b != NULL)
+        {
+          memcpy (b->data, buffer, BLOCK_SECTOR_SIZE);
+          if (b->logged)
+            {
+              b->logged = false;
+              unlogged_cnt++;
+            }
+        }
+      lock_release (&journal_lock);
+      if (b != NULL)
+        return;
+    }
+  block_write (fs_device, sector, buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR of the file
+   system device into BUFFER with a single device request, then
+   replaces any of them with pending metadata writes. */
+void
+journal_read_multiple (block_sector_t sector, size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  block_read_multiple (fs_device, sector, cnt, buffer);
+  if (journal_active)
+    {
+      size_t i;
+
+      lock_acquire (&journal_lock);
+      for (i = 0; i < block_cnt; i++)
+        if (blocks[i].sector >= sector && blocks[i].sector - sector < cnt)
+          memcpy (buffer + (blocks[i].sector - sector) * BLOCK_SECTOR_SIZE,
+                  blocks[i].data, BLOCK_SECTOR_SIZE);
+      lock_release (&journal_lock);
+    }
+}
+
+/* Writes CNT consecutive file data sectors starting at SECTOR of
+   the file system device from BUFFER with a single device
+   request.  Like journal_write_through(), updates the pending
+   copy of any of them that was recently metadata; those sectors
+   are written to disk as well, which is harmless because the
+   checkpoint will write the same data. */
+void
+journal_write_through_multiple (block_sector_t sector, size_t cnt,
+                                const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+
+  if (journal_active)
+    {
+      size_t i;
+
+      lock_acquire (&journal_lock);
+      for (i = 0; i < block_cnt; i++)
+        if (blocks[i].sector >= sector && blocks[i].sector - sector < cnt)
+          {
+            memcpy (blocks[i].data,
+                    buffer + (blocks[i].sector - sector) * BLOCK_SECTOR_SIZE,
+                    BLOCK_SECTOR_SIZE);
+            if (blocks[i].logged)
+              {
+                blocks[i].logged = false;
+                unlogged_cnt++;
+              }
+          }
+      lock_release (&journal_lock);
+    }
+  block_write_multiple (fs_device, sector, cnt, buffer);
+}
+
+/* Returns the pending block for SECTOR, or a null pointer if
+   there is none. */
+static struct journal_block *
+find_block (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < block_cnt; i++)
+    if (blocks[i].sector == sector)
+      return &blocks[i];
+  return NULL;
+}
+
+/* Writes a header listing the CNT home SECTORS to the journal
+   slot that does not hold the newest header, making it the
+   newest. */
+static void
+write_header (size_t cnt, const block_sector_t *sectors)
+{
+  struct journal_header *h = calloc (1, sizeof *h);
+  int slot = !journal_slot;
+
+  if (h == NULL)
+    PANIC ("journal: out of memory");
+  h->magic = JOURNAL_MAGIC;
+  h->seq = journal_seq + 1;
+  h->block_cnt = cnt;
+  memcpy (h->sectors, sectors, cnt * sizeof *sectors);
+  block_write (fs_device, slot_start (slot), h);
+  free (h);
+
+  journal_seq++;
+  journal_slot = slot;
+}
+
+/* Logs every pending block to the journal.
+   The caller must hold journal_lock, with no transactions in
+   progress. */
+static void
+commit (void)
+{
+  block_sector_t sectors[JOURNAL_MAX_BLOCKS];
+  block_sector_t log = slot_start (!journal_slot) + 1;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (txn_cnt == 0);
+
+  if (unlogged_cnt == 0)
+    return;
+
+  /* Data first, then the header that makes it valid. */
+  for (i = 0; i < block_cnt; i++)
+    {
+      block_write (fs_device, log + i, blocks[i].data);
+      sectors[i] = blocks[i].sector;
+      blocks[i].logged = true;
+    }
+  write_header (block_cnt, sectors);
+  unlogged_cnt = 0;
+}
+
+/* Commits, then writes every pending block to its home sector
+   and marks the journal empty.
+   The caller must hold journal_lock, with no transactions in
+   progress. */
+static void
+checkpoint (void)
+{
+  size_t i;
+
+  commit ();
+  if (block_cnt == 0)
+    return;
+
+  /* Sort by sector, so that the writes sweep across the disk
+     once. */
+  for (i = 1; i < block_cnt; i++)
+    {
+      size_t j;
+      for (j = i; j > 0 && blocks[j - 1].sector > blocks[j].sector; j--)
+        {
+          struct journal_block tmp = blocks[j];
+          blocks[j] = blocks[j - 1];
+          blocks[j - 1] = tmp;
+        }
+    }
+
+  for (i = 0; i < block_cnt; i++)
+    block_write (fs_device, blocks[i].sector, blocks[i].data);
+  write_header (0, NULL);
+  block_cnt = 0;
+}
+
+/* Finds the newest journal header and, if it lists any logged
+   blocks, copies them to their home sectors. */
+static void
+replay (void)
+{
+  struct journal_header *h[2];
+  int slot;
+
+  for (slot = 0; slot < 2; slot++)
+    {
+      h[slot] = malloc (sizeof *h[slot]);
+      if (h[slot] == NULL)
+        PANIC ("journal: out of memory");
+      block_read (fs_device, slot_start (slot), h[slot]);
+    }
+
+  if (h[0]->magic != JOURNAL_MAGIC && h[1]->magic != JOURNAL_MAGIC)
+    PANIC ("journal: no valid header, file system not formatted?");
+  else if (h[1]->magic != JOURNAL_MAGIC)
+    slot = 0;
+  else if (h[0]->magic != JOURNAL_MAGIC)
+    slot = 1;
+  else
+    slot = h[1]->seq > h[0]->seq;
+  journal_slot = slot;
+  journal_seq = h[slot]->seq;
+
+  if (h[slot]->block_cnt > 0 && h[slot]->block_cnt <= JOURNAL_MAX_BLOCKS)
+    {
+      uint8_t *buffer = blocks[0].data;
+      block_sector_t log = slot_start (slot) + 1;
+      size_t i;
+
+      printf ("journal: replaying %"PRIu32" blocks\n", h[slot]->block_cnt);
+      for (i = 0; i < h[slot]->block_cnt; i++)
+        {
+          block_read (fs_device, log + i, buffer);
+          block_write (fs_device, h[slot]->sectors[i], buffer);
+        }
+      write_header (0, NULL);
+    }
+
+  free (h[0]);
+  free (h[1]);
+}
@@ -0,0 +1,22 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+void journal_create (void);
+void journal_init (void);
+void journal_done (void);
+void journal_sync (void);
+
+void journal_begin (void);
+void journal_end (void);
+
+void journal_read (block_sector_t, void *);
+void journal_write (block_sector_t, const void *);
+void journal_write_through (block_sector_t, const void *);
+void journal_read_multiple (block_sector_t, size_t cnt, void *);
+void journal_write_through_multiple (block_sector_t, size_t cnt,
+                                     const void *);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,67 @@
+#include "crc32c.h"
+#include <stdbool.h>
+
+/* CRC-32C, computed with the "slicing-by-8" method, which
+   consumes 8 bytes per step using 8 lookup tables of 256 entries
+   each.  Table K maps a byte to its contribution to the CRC when
+   followed by K more zero bytes. */
+
+/* The CRC-32C polynomial, bit-reversed. */
+#define POLY 0x82f63b78
+
+static uint32_t table[8][256];
+static bool table_ready;
+
+/* Computes the lookup tables. */
+static void
+init_table (void)
+{
+  int i, k;
+
+  for (i = 0; i < 256; i++)
+    {
+      uint32_t crc = i;
+      for (k = 0; k < 8; k++)
+        crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+      table[0][i] = crc;
+    }
+  for (i = 0; i < 256; i++)
+    for (k = 1; k < 8; k++)
+      table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+  table_ready = true;
+}
+
+/* Returns the CRC-32C of the SIZE bytes in BUF, continuing from
+   CRC, which should be the CRC of the data that precedes BUF,
+   or 0 if there is none. */
+uint32_t
+crc32c (uint32_t crc, const void *buf, size_t size)
+{
+  const uint8_t *p = buf;
+
+  if (!table_ready)
+    init_table ();
+
+  crc = ~crc;
+
+  /* Process leading bytes one at a time until P is aligned. */
+  for (; size > 0 && (uintptr_t) p % 4 != 0; size--)
+    crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  /* Process 8 bytes at a time.  (x86 is little-endian.) */
+  for (; size >= 8; size -= 8, p += 8)
+    {
+      uint32_t lo = *(const uint32_t *) p ^ crc;
+      uint32_t hi = *(const uint32_t *) (p + 4);
+      crc = (table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff]
+             ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24]
+             ^ table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff]
+             ^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24]);
+    }
+
+  /* Process trailing bytes. */
+  for (; size > 0; size--)
+    crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
@@ -0,0 +1,17 @@
+#ifndef __LIB_RDTSC_H
+#define __LIB_RDTSC_H
+
+#include <stdint.h>
+
+/* Returns the processor's time-stamp counter, which counts CPU
+   cycles since reset.  Useful for timing intervals far shorter
+   than a timer tick. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+#endif /* lib/rdtsc.h */
@@ -28,7 +28,13 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Batched I/O. */
+    SYS_RING_ENTER,             /* Runs queued operations from a ring. */
+
+    /* Checkpointing. */
+    SYS_FORK                    /* Clone this process copy-on-write. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,62 @@
+#ifndef __LIB_SYSCALL_RING_H
+#define __LIB_SYSCALL_RING_H
+
+#include <stdint.h>
+
+/* Layout of the batched system call ring shared between a user
+   process and the kernel by the ring_enter() system call.
+
+   The ring lives in the process's own memory.  The process fills
+   submission queue entries (SQEs) and advances sq_tail, then calls
+   ring_enter(), which carries out the queued operations in order,
+   posts one completion queue entry (CQE) for each, and advances
+   sq_head and cq_tail.  The process reaps completions by reading
+   CQEs and advancing cq_head.
+
+   Indexes run freely and wrap around at 2**32; an index refers to
+   slot (index % RING_ENTRIES).  The kernel only looks at the ring
+   during ring_enter(), so no memory barriers are needed. */
+
+/* Number of entries in each queue.  Must be a power of 2. */
+#define RING_ENTRIES 32
+
+/* Operations. */
+enum ring_op
+  {
+    RING_OP_NOP,                /* Do nothing. */
+    RING_OP_READ,               /* read(fd, buffer, size). */
+    RING_OP_WRITE,              /* write(fd, buffer, size). */
+    RING_OP_SEEK,               /* seek(fd, position). */
+    RING_OP_CLOSE               /* close(fd). */
+  };
+
+/* Submission queue entry. */
+struct ring_sqe
+  {
+    uint32_t opcode;            /* One of RING_OP_*. */
+    int32_t fd;                 /* File descriptor. */
+    void *buffer;               /* Data for reads and writes. */
+    uint32_t size;              /* Bytes to read or write. */
+    uint32_t position;          /* New file position for seeks. */
+    uint32_t user_data;         /* Copied into the completion. */
+  };
+
+/* Completion queue entry. */
+struct ring_cqe
+  {
+    uint32_t user_data;         /* From the submission. */
+    int32_t result;             /* Return value of the operation. */
+  };
+
+/* A submission and completion queue pair. */
+struct ring
+  {
+    uint32_t sq_head;           /* Next SQE to run.  Kernel writes. */
+    uint32_t sq_tail;           /* Next SQE to fill.  User writes. */
+    uint32_t cq_head;           /* Next CQE to reap.  User writes. */
+    uint32_t cq_tail;           /* Next CQE to post.  Kernel writes. */
+    struct ring_sqe sq[RING_ENTRIES];   /* Submission queue. */
+    struct ring_cqe cq[RING_ENTRIES];   /* Completion queue. */
+  };
+
+#endif /* lib/syscall-ring.h */
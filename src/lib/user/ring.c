@@ -0,0 +1,113 @@
+#include <ring.h>
+#include <string.h>
+#include <syscall.h>
+
+static struct ring_sqe *get_sqe (struct ring *, enum ring_op, int fd,
+                                 uint32_t user_data);
+
+/* Initializes RING with empty queues. */
+void
+ring_init (struct ring *ring)
+{
+  memset (ring, 0, sizeof *ring);
+}
+
+/* Queues a read of SIZE bytes from FD into BUFFER.
+   Returns true if successful, false if the submission queue is
+   full. */
+bool
+ring_prep_read (struct ring *ring, int fd, void *buffer, unsigned size,
+                uint32_t user_data)
+{
+  struct ring_sqe *sqe = get_sqe (ring, RING_OP_READ, fd, user_data);
+  if (sqe == NULL)
+    return false;
+  sqe->buffer = buffer;
+  sqe->size = size;
+  return true;
+}
+
+/* Queues a write of SIZE bytes from BUFFER to FD.
+   Returns true if successful, false if the submission queue is
+   full. */
+bool
+ring_prep_write (struct ring *ring, int fd, const void *buffer,
+                 unsigned size, uint32_t user_data)
+{
+  struct ring_sqe *sqe = get_sqe (ring, RING_OP_WRITE, fd, user_data);
+  if (sqe == NULL)
+    return false;
+  sqe->buffer = (void *) buffer;
+  sqe->size = size;
+  return true;
+}
+
+/* Queues a seek of FD to POSITION.
+   Returns true if successful, false if the submission queue is
+   full. */
+bool
+ring_prep_seek (struct ring *ring, int fd, unsigned position,
+                uint32_t user_data)
+{
+  struct ring_sqe *sqe = get_sqe (ring, RING_OP_SEEK, fd, user_data);
+  if (sqe == NULL)
+    return false;
+  sqe->position = position;
+  return true;
+}
+
+/* Queues closing FD.
+   Returns true if successful, false if the submission queue is
+   full. */
+bool
+ring_prep_close (struct ring *ring, int fd, uint32_t user_data)
+{
+  return get_sqe (ring, RING_OP_CLOSE, fd, user_data) != NULL;
+}
+
+/* Returns the number of queued operations not yet submitted. */
+unsigned
+ring_pending (const struct ring *ring)
+{
+  return ring->sq_tail - ring->sq_head;
+}
+
+/* Submits every queued operation to the kernel with a single
+   system call.  The kernel stops early if the completion queue
+   fills up, leaving the rest queued.
+   Returns the number of operations carried out. */
+int
+ring_submit (struct ring *ring)
+{
+  return ring_enter (ring, ring_pending (ring));
+}
+
+/* Removes the oldest completion from RING and stores it in *CQE.
+   Returns true if successful, false if there are no
+   completions. */
+bool
+ring_reap (struct ring *ring, struct ring_cqe *cqe)
+{
+  if (ring->cq_head == ring->cq_tail)
+    return false;
+  *cqe = ring->cq[ring->cq_head++ % RING_ENTRIES];
+  return true;
+}
+
+/* Claims the next free SQE in RING and fills in its OPCODE, FD,
+   and USER_DATA.  Returns the SQE, or a null pointer if the
+   submission queue is full. */
+static struct ring_sqe *
+get_sqe (struct ring *ring, enum ring_op opcode, int fd, uint32_t user_data)
+{
+  struct ring_sqe *sqe;
+
+  if (ring_pending (ring) >= RING_ENTRIES)
+    return NULL;
+  sqe = &ring->sq[ring->sq_tail++ % RING_ENTRIES];
+  memset (sqe, 0, sizeof *sqe);
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = user_data;
+  return sqe;
+}
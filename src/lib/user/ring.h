@@ -0,0 +1,21 @@
+#ifndef __LIB_USER_RING_H
+#define __LIB_USER_RING_H
+
+#include <stdbool.h>
+#include <syscall-ring.h>
+
+void ring_init (struct ring *);
+
+bool ring_prep_read (struct ring *, int fd, void *buffer, unsigned size,
+                     uint32_t user_data);
+bool ring_prep_write (struct ring *, int fd, const void *buffer,
+                      unsigned size, uint32_t user_data);
+bool ring_prep_seek (struct ring *, int fd, unsigned position,
+                     uint32_t user_data);
+bool ring_prep_close (struct ring *, int fd, uint32_t user_data);
+
+unsigned ring_pending (const struct ring *);
+int ring_submit (struct ring *);
+bool ring_reap (struct ring *, struct ring_cqe *);
+
+#endif /* lib/user/ring.h */
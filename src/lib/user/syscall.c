@@ -1,6 +1,10 @@
 #include <syscall.h>
 #include "../syscall-nr.h"
 
+#ifndef SYSCALL_SYSENTER
+
+/* By default, system calls enter the kernel with "int $0x30". */
+
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
@@ -61,6 +65,82 @@
           retval;                                               \
         })
 
+#else /* SYSCALL_SYSENTER */
+
+/* Built with -DSYSCALL_SYSENTER (e.g. "make DEFINES=-DSYSCALL_SYSENTER"),
+   system calls enter the kernel with SYSENTER, which is faster
+   than "int $0x30" but requires a CPU that supports it.  The
+   number and arguments go on the stack as usual.  We pass the
+   stack pointer in %ecx and the address to return to in %edx,
+   which the kernel's SYSEXIT uses to come back. */
+
+/* Invokes syscall NUMBER, passing no arguments, and returns the
+   return value as an `int'. */
+#define syscall0(NUMBER)                                        \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[number]; movl %%esp, %%ecx; "             \
+             "movl $1f, %%edx; sysenter; 1: addl $4, %%esp"     \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER)                          \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
+        })
+
+/* Invokes syscall NUMBER, passing argument ARG0, and returns the
+   return value as an `int'. */
+#define syscall1(NUMBER, ARG0)                                  \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg0]; pushl %[number]; "                 \
+             "movl %%esp, %%ecx; movl $1f, %%edx; "             \
+             "sysenter; 1: addl $8, %%esp"                      \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "g" (ARG0)                              \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
+        })
+
+/* Invokes syscall NUMBER, passing arguments ARG0 and ARG1, and
+   returns the return value as an `int'. */
+#define syscall2(NUMBER, ARG0, ARG1)                            \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg1]; pushl %[arg0]; pushl %[number]; "  \
+             "movl %%esp, %%ecx; movl $1f, %%edx; "             \
+             "sysenter; 1: addl $12, %%esp"                     \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "g" (ARG0),                             \
+                 [arg1] "g" (ARG1)                              \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
+        })
+
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, and
+   ARG2, and returns the return value as an `int'. */
+#define syscall3(NUMBER, ARG0, ARG1, ARG2)                      \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
+             "pushl %[number]; movl %%esp, %%ecx; "             \
+             "movl $1f, %%edx; sysenter; 1: addl $16, %%esp"    \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "g" (ARG0),                             \
+                 [arg1] "g" (ARG1),                             \
+                 [arg2] "g" (ARG2)                              \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
+        })
+
+#endif /* SYSCALL_SYSENTER */
+
 void
 halt (void) 
 {
@@ -182,3 +262,23 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+ring_enter (struct ring *ring, unsigned to_submit)
+{
+  return syscall2 (SYS_RING_ENTER, ring, to_submit);
+}
+
+pid_t
+fork (void)
+{
+  /* Always enters with "int $0x30", even in a SYSENTER build,
+     because the child starts from the full set of user registers
+     that only the interrupt path saves. */
+  int retval;
+  asm volatile ("pushl %[number]; int $0x30; addl $4, %%esp"
+                : "=a" (retval)
+                : [number] "i" (SYS_FORK)
+                : "memory");
+  return retval;
+}
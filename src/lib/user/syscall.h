@@ -45,4 +45,11 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Batched I/O.  See <ring.h> for a friendlier interface. */
+struct ring;
+int ring_enter (struct ring *, unsigned to_submit);
+
+/* Checkpointing. */
+pid_t fork (void);
+
 #endif /* lib/user/syscall.h */
@@ -22,10 +22,12 @@
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
+#include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #else
@@ -33,10 +35,19 @@
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "devices/checksum.h"
 #include "devices/ide.h"
+#include "devices/iosched.h"
+#include "devices/ramdisk.h"
 #include "filesys/filesys.h"
+#include "filesys/fsbench.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -52,6 +63,22 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk: Size of RAM disk in kB, or 0 for none. */
+static size_t ramdisk_kb;
+
+/* -ramdisk-load: Fill the RAM disk at startup?  From the block
+   device with the given name, if any, otherwise from the scratch
+   device. */
+static bool ramdisk_preload;
+static const char *ramdisk_load_name;
+
+/* -checksum: Name of block device to stack a checksum device on,
+   or null for none.
+   -scrub: Rate at which to scrub it, in sectors per second, or 0
+   not to scrub. */
+static const char *checksum_bdev_name;
+static int scrub_rate;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -68,6 +95,8 @@ static void usage (void);
 #ifdef FILESYS
 static void locate_block_devices (void);
 static void locate_block_device (enum block_type, const char *name);
+static void load_ramdisk (void);
+static void make_checksum_device (void);
 #endif
 
 int main (void) NO_RETURN;
@@ -98,6 +127,9 @@ main (void)
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+#ifdef USERPROG
+  pagedir_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -123,10 +155,23 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  if (ramdisk_kb > 0)
+    ramdisk_init (ramdisk_kb);
+  if (checksum_bdev_name != NULL)
+    make_checksum_device ();
   locate_block_devices ();
+  if (ramdisk_preload)
+    load_ramdisk ();
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  page_init ();
+  frame_init ();
+  swap_init ();
+#endif
+
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -247,6 +292,22 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-ramdisk-load"))
+        {
+          ramdisk_preload = true;
+          ramdisk_load_name = value;
+        }
+      else if (!strcmp (name, "-checksum"))
+        checksum_bdev_name = value;
+      else if (!strcmp (name, "-scrub"))
+        scrub_rate = atoi (value);
+      else if (!strcmp (name, "-iosched"))
+        {
+          if (!iosched_set_default (value))
+            PANIC ("unknown I/O scheduler `%s'", value);
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -259,6 +320,19 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-stack"))
+        {
+          /* Nonzero, and no more than all of user memory, so
+             that PHYS_BASE - page_stack_max cannot wrap
+             around. */
+          int mb = atoi (value);
+          if (mb < 1 || (uintptr_t) mb > (uintptr_t) PHYS_BASE / 1024 / 1024)
+            PANIC ("-stack must be between 1 and %"PRIuPTR" MB",
+                   (uintptr_t) PHYS_BASE / 1024 / 1024);
+          page_stack_max = (size_t) mb * 1024 * 1024;
+        }
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -292,6 +366,23 @@ run_task (char **argv)
   printf ("Execution of '%s' complete.\n", task);
 }
 
+#ifdef FILESYS
+/* Prints statistics for the block devices used since startup or
+   the last "iostat-reset". */
+static void
+print_block_stats (char **argv UNUSED)
+{
+  block_print_all_stats ();
+}
+
+/* Resets block device statistics. */
+static void
+reset_block_stats (char **argv UNUSED)
+{
+  block_reset_stats ();
+}
+#endif
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -315,6 +406,13 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"snapshot", 2, fsutil_snapshot},
+      {"snapshot-copy", 2, fsutil_snapshot_copy},
+      {"iostat", 1, print_block_stats},
+      {"iostat-reset", 1, reset_block_stats},
+      {"bench-create", 2, fsbench_create},
+      {"bench-lg-create", 2, fsbench_large_create},
+      {"bench-seq", 2, fsbench_sequential},
 #endif
       {NULL, 0, NULL},
     };
@@ -361,9 +459,17 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  iostat             Print block device statistics.\n"
+          "  iostat-reset       Reset block device statistics.\n"
+          "  snapshot BDEV      Snapshot file system, keeping changes on BDEV.\n"
+          "  snapshot-copy BDEV  Copy the latest snapshot to BDEV.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
+          "Benchmarks, best run right after -f:\n"
+          "  bench-create N     Create and remove N files, count writes.\n"
+          "  bench-lg-create SIZE  Time creating SIZE-byte files.\n"
+          "  bench-seq SIZE     Time sequential I/O on a SIZE-byte file.\n"
 #endif
           "\nOptions:\n"
           "  -h                 Print this help message and power off.\n"
@@ -373,6 +479,12 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=KB        Create a KB-kB RAM disk named ram0.\n"
+          "  -ramdisk-load[=BDEV]  Copy BDEV, or scratch, into ram0 at startup.\n"
+          "  -checksum=BDEV     Stack checksum device BDEV.crc on BDEV.\n"
+          "  -scrub=RATE        Scrub BDEV.crc at RATE sectors per second.\n"
+          "  -iosched=POLICY    Schedule disk I/O with POLICY: noop, clook\n"
+          "                     (the default), or deadline.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -381,6 +493,9 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -stack=MB          Limit user stacks to MB megabytes.\n"
 #endif
           );
   shutdown_power_off ();
@@ -426,4 +541,33 @@ locate_block_device (enum block_type role, const char *name)
       block_set_role (role, block);
     }
 }
+
+/* Fills the RAM disk from the block device named by the
+   -ramdisk-load option, or from the scratch device by default. */
+static void
+load_ramdisk (void)
+{
+  struct block *from;
+
+  if (ramdisk_load_name != NULL)
+    from = block_get_by_name (ramdisk_load_name);
+  else
+    from = block_get_role (BLOCK_SCRATCH);
+  if (from == NULL)
+    PANIC ("No %s device to load RAM disk from",
+           ramdisk_load_name != NULL ? ramdisk_load_name : "scratch");
+  ramdisk_load (from);
+}
+
+/* Stacks a checksum device on the block device named by the
+   -checksum option. */
+static void
+make_checksum_device (void)
+{
+  struct block *parent = block_get_by_name (checksum_bdev_name);
+
+  if (parent == NULL)
+    PANIC ("No such block device \"%s\"", checksum_bdev_name);
+  checksum_init (parent, scrub_rate);
+}
 #endif
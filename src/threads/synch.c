@@ -129,7 +129,12 @@ sema_up (struct semaphore *sema)
   sema->value++;
   /* CODE added */
   /* IMPORTANT */
-  thread_yield();
+  /* An interrupt handler cannot yield directly, so it yields
+     when it returns instead. */
+  if (intr_context ())
+    intr_yield_on_return ();
+  else
+    thread_yield();
   /* ^ CODE added */
   intr_set_level(old_level);
 }
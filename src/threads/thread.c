@@ -651,6 +651,16 @@ init_thread (struct thread *t, const char *name, int priority)
   list_init (&t ->locks);
   t ->blocked = NULL;
   /* ^ CODE added */
+#ifdef USERPROG
+  t->exit_status = -1;
+  list_init (&t->children);
+  list_init (&t->files);
+  t->next_fd = 2;
+#endif
+#ifdef VM
+  t->pages = NULL;
+  list_init (&t->mappings);
+#endif
 }
 
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
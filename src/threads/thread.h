@@ -5,6 +5,10 @@
 #include <list.h>
 #include <stdint.h>
 
+struct file;
+struct hash;
+struct intr_frame;
+
 /* States in a thread's life cycle. */
 enum thread_status
   {
@@ -103,9 +107,37 @@ struct thread
     int recent_cpu;                     /* Value of recent cpu usage. */
     /* ^ CODE added */
 
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of open transactions. */
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    int exit_status;                    /* Status to report to parent. */
+    struct child *child;                /* Shared with parent, if any. */
+    struct list children;               /* Children's struct child. */
+    struct file *executable;            /* Running executable, if any. */
+
+    /* Owned by userprog/syscall.c. */
+    struct list files;                  /* Open file descriptors. */
+    int next_fd;                        /* Next descriptor to assign. */
+    struct intr_frame *syscall_frame;   /* Frame of "int $0x30" system
+                                           call in progress, if any. */
+    void *user_esp;                     /* User stack pointer at last
+                                           system call. */
+#endif
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash *pages;                 /* Supplemental page table. */
+    uint8_t *fault_last;                /* Last page faulted or brought
+                                           in around a fault. */
+    int fault_dir;                      /* Direction of recent faults. */
+    size_t fault_window;                /* Pages to bring in around the
+                                           next fault. */
+
+    /* Owned by userprog/syscall.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Next mapping id to assign. */
 #endif
 
     /* Owned by thread.c. */
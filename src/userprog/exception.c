@@ -2,8 +2,14 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/pagedir.h"
+#include "userprog/uaccess.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,6 +154,36 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* The first write to a page shared copy-on-write gets a
+     private copy. */
+  if (!not_present && write && is_user_vaddr (fault_addr)
+      && thread_current ()->pagedir != NULL
+      && pagedir_cow_fault (thread_current ()->pagedir, fault_addr))
+    return;
+
+#ifdef VM
+  /* Bring in a page of the process's address space on first
+     touch, or give it a private copy of the shared zero page on
+     first write.  A fault just below the stack grows the stack.
+     For a fault in the kernel, the user stack pointer is the one
+     saved at the system call.  This comes before the fixup check
+     so that copies to and from user memory can touch such pages
+     too. */
+  if (is_user_vaddr (fault_addr))
+    {
+      void *esp = user ? f->esp : thread_current ()->user_esp;
+      if (page_in (fault_addr, write)
+          || (page_grow_stack (fault_addr, esp)
+              && page_in (fault_addr, write)))
+        return;
+    }
+#endif
+
+  /* A fault in the kernel while copying to or from user memory
+     makes the copy fail, not the kernel. */
+  if (!user && uaccess_fixup (f))
+    return;
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
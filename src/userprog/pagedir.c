@@ -1,13 +1,48 @@
 #include "userprog/pagedir.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#include <round.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
+/* PTE bit, in the bits available to the OS, that marks a page
+   shared copy-on-write by pagedir_clone_cow().  Such a page is
+   mapped read-only until the first write to it. */
+#define PTE_COW 0x00000200
+
+/* Number of page directories sharing each physical page, beyond
+   the first, indexed by physical page number.  Zero for pages
+   that are not shared, which is all of them until a clone. */
+static uint16_t *share_cnt;
+
+/* Number of pages copied by pagedir_cow_fault(). */
+static long long cow_copy_cnt;
+
+static uint32_t *lookup_page (uint32_t *pd, const void *vaddr, bool create);
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static bool is_shared (void *kpage);
+static bool unshare (void *kpage);
+
+/* Initializes the page sharing counts. */
+void
+pagedir_init (void)
+{
+  size_t size = init_ram_pages * sizeof *share_cnt;
+  share_cnt = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                                   DIV_ROUND_UP (size, PGSIZE));
+}
+
+/* Prints copy-on-write statistics. */
+void
+pagedir_print_stats (void)
+{
+  printf ("Copy-on-write: %lld pages copied\n", cow_copy_cnt);
+}
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -23,7 +58,7 @@ pagedir_create (void)
 }
 
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references that no other page directory shares. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -40,13 +75,114 @@ pagedir_destroy (uint32_t *pd)
         uint32_t *pte;
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P) 
+          if ((*pte & PTE_P) && !unshare (pte_get_page (*pte)))
             palloc_free_page (pte_get_page (*pte));
         palloc_free_page (pt);
       }
   palloc_free_page (pd);
 }
 
+/* Creates a new page directory whose user mappings are those of
+   PD, sharing the same physical pages instead of copying them.
+   Writable pages become read-only copy-on-write pages in both
+   page directories, so that the first write to one in either
+   gets a private copy from pagedir_cow_fault().
+   Returns the new page directory, or a null pointer if memory
+   allocation fails.
+
+   Not available with VM: each frame in the frame table belongs
+   to a single page of a single process, and eviction would unmap
+   it from that process only, leaving the clone mapping a frame
+   that gets reused. */
+#ifndef VM
+uint32_t *
+pagedir_clone_cow (uint32_t *pd)
+{
+  uint32_t *clone = pagedir_create ();
+  uint32_t *pde;
+
+  if (clone == NULL)
+    return NULL;
+
+  for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P)
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        size_t i;
+
+        for (i = 0; i < PGSIZE / sizeof *pt; i++)
+          {
+            void *upage = (void *) (((pde - pd) << PDSHIFT)
+                                    | (i << PTSHIFT));
+            uint32_t *clone_pte;
+            enum intr_level old_level;
+
+            if (!(pt[i] & PTE_P))
+              continue;
+            clone_pte = lookup_page (clone, upage, true);
+            if (clone_pte == NULL)
+              {
+                invalidate_pagedir (pd);
+                pagedir_destroy (clone);
+                return NULL;
+              }
+
+            if (pt[i] & PTE_W)
+              pt[i] = (pt[i] & ~PTE_W) | PTE_COW;
+            *clone_pte = pt[i] & ~(PTE_A | PTE_D);
+
+            old_level = intr_disable ();
+            share_cnt[vtop (pte_get_page (pt[i])) >> PGBITS]++;
+            intr_set_level (old_level);
+          }
+      }
+
+  /* PD's writable mappings just became read-only. */
+  invalidate_pagedir (pd);
+  return clone;
+}
+#endif
+
+/* Resolves a write fault at user address UADDR in PD, if it is
+   the first write to a copy-on-write page since it was shared:
+   gives PD a private, writable copy of the page, or makes the
+   page writable in place if no other page directory still
+   shares it.
+   Returns true if successful, false if UADDR is not a
+   copy-on-write page or memory for the copy is not available. */
+bool
+pagedir_cow_fault (uint32_t *pd, const void *uaddr)
+{
+  uint32_t *pte = lookup_page (pd, uaddr, false);
+  void *kpage, *copy = NULL;
+
+  if (pte == NULL || (*pte & (PTE_P | PTE_COW)) != (PTE_P | PTE_COW))
+    return false;
+  kpage = pte_get_page (*pte);
+
+  /* No one can write KPAGE while it is shared, so copying it
+     without holding anything is safe.  If the other sharers let
+     go of it meanwhile, the copy is not needed after all. */
+  if (is_shared (kpage))
+    {
+      copy = palloc_get_page (PAL_USER);
+      if (copy == NULL)
+        return false;
+      memcpy (copy, kpage, PGSIZE);
+      if (unshare (kpage))
+        cow_copy_cnt++;
+      else
+        {
+          palloc_free_page (copy);
+          copy = NULL;
+        }
+    }
+
+  *pte = pte_create_user (copy != NULL ? copy : kpage, true);
+  invalidate_pagedir (pd);
+  return true;
+}
+
 /* Returns the address of the page table entry for virtual
    address VADDR in page directory PD.
    If PD does not have a page table for VADDR, behavior depends
@@ -261,3 +397,29 @@ invalidate_pagedir (uint32_t *pd)
       pagedir_activate (pd);
     } 
 }
+
+/* Returns true if another page directory shares KPAGE. */
+static bool
+is_shared (void *kpage)
+{
+  return share_cnt != NULL && share_cnt[vtop (kpage) >> PGBITS] > 0;
+}
+
+/* If KPAGE is shared with another page directory, drops one
+   share and returns true.  Otherwise, returns false, meaning
+   that the caller is KPAGE's only user. */
+static bool
+unshare (void *kpage)
+{
+  enum intr_level old_level;
+  bool shared;
+
+  if (share_cnt == NULL)
+    return false;
+  old_level = intr_disable ();
+  shared = share_cnt[vtop (kpage) >> PGBITS] > 0;
+  if (shared)
+    share_cnt[vtop (kpage) >> PGBITS]--;
+  intr_set_level (old_level);
+  return shared;
+}
@@ -4,8 +4,15 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+void pagedir_init (void);
+void pagedir_print_stats (void);
+
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
+#ifndef VM
+uint32_t *pagedir_clone_cow (uint32_t *pd);
+#endif
+bool pagedir_cow_fault (uint32_t *pd, const void *uaddr);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
@@ -7,6 +7,7 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -14,43 +15,114 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* A child process's exit status, shared between the child and
+   its parent, so that it outlives whichever of them exits
+   first. */
+struct child
+  {
+    struct list_elem elem;              /* Element in parent's children. */
+    tid_t tid;                          /* Child's thread id. */
+    int exit_status;                    /* Valid once DEAD is up'd. */
+    struct semaphore dead;              /* Up'd when the child exits. */
+    int ref_cnt;                        /* Number of parent and child
+                                           that have not exited. */
+  };
+
+/* Passed from process_execute() to start_process(). */
+struct exec_info
+  {
+    char *cmdline;                      /* Command line, in a page. */
+    struct child *child;                /* The child's struct child. */
+    struct semaphore loaded;            /* Up'd when load finishes. */
+    bool success;                       /* Did load succeed? */
+  };
+
+#ifndef VM
+/* Passed from process_fork() to start_fork(). */
+struct fork_info
+  {
+    struct intr_frame frame;            /* Parent's user registers. */
+    struct thread *parent;              /* Parent thread. */
+    struct child *child;                /* The child's struct child. */
+    struct semaphore started;           /* Up'd when fork finishes. */
+    bool success;                       /* Did fork succeed? */
+  };
+
+static thread_func start_fork NO_RETURN;
+#endif
 
 static thread_func start_process NO_RETURN;
-static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static bool load (char *cmdline, void (**eip) (void), void **esp);
+static struct child *new_child (void);
+static void release_child (struct child *);
 
 /* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+   FILE_NAME, which may be followed by arguments separated by
+   spaces.  Waits for the program to load.  Returns the new
+   process's thread id, or TID_ERROR if the thread cannot be
+   created or the program cannot be loaded. */
 tid_t
 process_execute (const char *file_name) 
 {
-  char *fn_copy;
+  struct exec_info exec;
+  char name[16];
   tid_t tid;
 
   /* Make a copy of FILE_NAME.
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  exec.cmdline = palloc_get_page (0);
+  if (exec.cmdline == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
+  strlcpy (exec.cmdline, file_name, PGSIZE);
 
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
-  if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+  exec.child = new_child ();
+  if (exec.child == NULL)
+    {
+      palloc_free_page (exec.cmdline);
+      return TID_ERROR;
+    }
+  sema_init (&exec.loaded, 0);
+
+  /* Create a new thread to execute FILE_NAME, named after the
+     program. */
+  strlcpy (name, file_name, sizeof name);
+  name[strcspn (name, " ")] = '\0';
+  tid = thread_create (name, PRI_DEFAULT, start_process, &exec);
+  if (tid != TID_ERROR)
+    {
+      sema_down (&exec.loaded);
+      if (exec.success)
+        {
+          exec.child->tid = tid;
+          list_push_back (&thread_current ()->children, &exec.child->elem);
+        }
+      else
+        {
+          tid = TID_ERROR;
+          release_child (exec.child);
+        }
+    }
+  else
+    free (exec.child);
+  palloc_free_page (exec.cmdline);
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *exec_)
 {
-  char *file_name = file_name_;
+  struct exec_info *exec = exec_;
   struct intr_frame if_;
   bool success;
 
@@ -59,10 +131,15 @@ start_process (void *file_name_)
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = load (exec->cmdline, &if_.eip, &if_.esp);
+
+  /* Tell our parent how the load went.  EXEC belongs to the
+     parent and goes away once it wakes up. */
+  thread_current ()->child = exec->child;
+  exec->success = success;
+  sema_up (&exec->loaded);
 
   /* If load failed, quit. */
-  palloc_free_page (file_name);
   if (!success) 
     thread_exit ();
 
@@ -76,21 +153,157 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+#ifndef VM
+/* Starts a new process that is a copy of the current one, with
+   user registers F, except that it returns 0 from the system
+   call.  The copy shares all of the current process's pages
+   copy-on-write, so it costs nothing until one of the two
+   writes to a page.  It also inherits the current process's open
+   files.  Waits for the copy to start.  Returns the new process's
+   thread id, or TID_ERROR if it cannot be created. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct thread *cur = thread_current ();
+  struct fork_info fork;
+  tid_t tid;
+
+  fork.child = new_child ();
+  if (fork.child == NULL)
+    return TID_ERROR;
+  fork.frame = *f;
+  fork.parent = cur;
+  sema_init (&fork.started, 0);
+
+  tid = thread_create (cur->name, PRI_DEFAULT, start_fork, &fork);
+  if (tid != TID_ERROR)
+    {
+      sema_down (&fork.started);
+      if (fork.success)
+        {
+          fork.child->tid = tid;
+          list_push_back (&cur->children, &fork.child->elem);
+        }
+      else
+        {
+          tid = TID_ERROR;
+          release_child (fork.child);
+        }
+    }
+  else
+    free (fork.child);
+  return tid;
+}
+
+/* A thread function that makes the current thread a copy of the
+   process that called process_fork() and starts it running. */
+static void
+start_fork (void *fork_)
+{
+  struct fork_info *fork = fork_;
+  struct thread *t = thread_current ();
+  struct thread *parent = fork->parent;
+  struct intr_frame if_ = fork->frame;
+  bool success = false;
+
+  /* The parent waits for us, so its address space and files
+     hold still while we copy them. */
+  t->pagedir = pagedir_clone_cow (parent->pagedir);
+  if (t->pagedir != NULL)
+    {
+      process_activate ();
+      lock_acquire (&filesys_lock);
+      t->executable = file_reopen (parent->executable);
+      if (t->executable != NULL)
+        file_deny_write (t->executable);
+      lock_release (&filesys_lock);
+      if (t->executable != NULL)
+        success = syscall_inherit (parent);
+    }
+
+  /* Tell our parent how the fork went.  FORK belongs to the
+     parent and goes away once it wakes up. */
+  t->child = fork->child;
+  fork->success = success;
+  sema_up (&fork->started);
+
+  if (!success)
+    thread_exit ();
+
+  /* Return 0 from fork() in the child, then start it running as
+     start_process() does. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+#else
+/* Fails: frames in the frame table have a single owner, so pages
+   cannot be shared copy-on-write with virtual memory. */
+tid_t
+process_fork (const struct intr_frame *f UNUSED)
+{
+  return TID_ERROR;
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = list_next (e))
+    {
+      struct child *c = list_entry (e, struct child, elem);
+      if (c->tid == child_tid)
+        {
+          int status;
+
+          sema_down (&c->dead);
+          status = c->exit_status;
+          list_remove (&c->elem);
+          release_child (c);
+          return status;
+        }
+    }
   return -1;
 }
 
+/* Creates and returns a struct child for a child about to be
+   started, or a null pointer if memory is not available. */
+static struct child *
+new_child (void)
+{
+  struct child *c = malloc (sizeof *c);
+  if (c != NULL)
+    {
+      c->exit_status = -1;
+      sema_init (&c->dead, 0);
+      c->ref_cnt = 2;
+    }
+  return c;
+}
+
+/* Drops a reference to C, freeing it when neither the parent
+   nor the child needs it any longer. */
+static void
+release_child (struct child *c)
+{
+  enum intr_level old_level = intr_disable ();
+  bool last = --c->ref_cnt == 0;
+  intr_set_level (old_level);
+
+  if (last)
+    free (c);
+}
+
 /* Free the current process's resources. */
 void
 process_exit (void)
@@ -98,6 +311,33 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  if (cur->pagedir != NULL)
+    printf ("%s: exit(%d)\n", cur->name, cur->exit_status);
+  syscall_exit ();
+  if (cur->executable != NULL)
+    {
+      lock_acquire (&filesys_lock);
+      file_close (cur->executable);
+      lock_release (&filesys_lock);
+      cur->executable = NULL;
+    }
+#ifdef VM
+  page_table_destroy ();
+#endif
+
+  /* Report our exit status to our parent and let go of our
+     children's. */
+  if (cur->child != NULL)
+    {
+      cur->child->exit_status = cur->exit_status;
+      sema_up (&cur->child->dead);
+      release_child (cur->child);
+      cur->child = NULL;
+    }
+  while (!list_empty (&cur->children))
+    release_child (list_entry (list_pop_front (&cur->children),
+                               struct child, elem));
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -195,33 +435,47 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
-static bool setup_stack (void **esp);
+static bool setup_stack (void **esp, char *prog, char **save_ptr);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
+/* Loads the ELF executable named by the first word of CMDLINE
+   into the current thread, and passes it the words of CMDLINE
+   as arguments.  CMDLINE is modified.
    Stores the executable's entry point into *EIP
    and its initial stack pointer into *ESP.
    Returns true if successful, false otherwise. */
 bool
-load (const char *file_name, void (**eip) (void), void **esp) 
+load (char *cmdline, void (**eip) (void), void **esp) 
 {
   struct thread *t = thread_current ();
   struct Elf32_Ehdr ehdr;
   struct file *file = NULL;
   off_t file_ofs;
   bool success = false;
+  char *file_name, *save_ptr;
   int i;
 
+  file_name = strtok_r (cmdline, " ", &save_ptr);
+  if (file_name == NULL)
+    return false;
+
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
+#ifdef VM
+  if (!page_table_create ())
+    goto done;
+#endif
 
-  /* Open executable file. */
+  /* Open executable file.  filesys_lock is held until the
+     segments are set up, but not while the stack is, because
+     that touches user memory. */
+  lock_acquire (&filesys_lock);
   file = filesys_open (file_name);
   if (file == NULL) 
     {
@@ -301,24 +555,40 @@ load (const char *file_name, void (**eip) (void), void **esp)
         }
     }
 
+  lock_release (&filesys_lock);
+
   /* Set up stack. */
-  if (!setup_stack (esp))
+  if (!setup_stack (esp, file_name, &save_ptr))
     goto done;
 
   /* Start address. */
   *eip = (void (*) (void)) ehdr.e_entry;
 
+  /* Keep the executable open, and unchanged, while it runs.
+     Its pages are read from it as they are touched. */
+  lock_acquire (&filesys_lock);
+  file_deny_write (file);
+  lock_release (&filesys_lock);
+  t->executable = file;
   success = true;
 
  done:
   /* We arrive here whether the load is successful or not. */
-  file_close (file);
+  if (!success)
+    {
+      if (!lock_held_by_current_thread (&filesys_lock))
+        lock_acquire (&filesys_lock);
+      file_close (file);
+      lock_release (&filesys_lock);
+    }
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -377,6 +647,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table here, and brought in by the page
+   fault handler when the process first touches them.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -396,6 +670,12 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record where the page comes from. */
+      if (!page_add (upage, file, ofs, page_read_bytes, writable))
+        return false;
+      ofs += page_read_bytes;
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -415,6 +695,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -424,26 +705,73 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   return true;
 }
 
+/* Maximum number of command-line arguments. */
+#define MAX_ARGS 64
+
 /* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+   user virtual memory, and push the arguments to main() onto
+   it: PROG followed by the rest of the words that strtok_r()
+   finds with *SAVE_PTR. */
 static bool
-setup_stack (void **esp) 
+setup_stack (void **esp, char *prog, char **save_ptr) 
 {
-  uint8_t *kpage;
-  bool success = false;
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+  uint8_t *sp = PHYS_BASE;
+  char *argv[MAX_ARGS];
+  int argc = 0;
+  char *arg;
+  int i;
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-  if (kpage != NULL) 
+#ifdef VM
+  if (!page_add (upage, NULL, 0, 0, true) || !page_in (upage, true))
+    return false;
+#else
+  uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+  if (kpage == NULL)
+    return false;
+  if (!install_page (upage, kpage, true))
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success)
-        *esp = PHYS_BASE;
-      else
-        palloc_free_page (kpage);
+      palloc_free_page (kpage);
+      return false;
     }
-  return success;
+#endif
+
+  /* Copy the argument strings to the top of the page, leaving
+     room below them for argv[] and the rest. */
+  for (arg = prog; arg != NULL; arg = strtok_r (NULL, " ", save_ptr))
+    {
+      size_t len = strlen (arg) + 1;
+      if (argc >= MAX_ARGS
+          || (size_t) (sp - (uint8_t *) PHYS_BASE + PGSIZE)
+             < len + (argc + 5) * sizeof (char *) + sizeof (int))
+        return false;
+      sp -= len;
+      memcpy (sp, arg, len);
+      argv[argc++] = (char *) sp;
+    }
+
+  /* Word-align, then push argv[argc] (a null pointer), argv[],
+     argv, argc, and a fake return address. */
+  sp = (uint8_t *) ROUND_DOWN ((uintptr_t) sp, sizeof (char *));
+  sp -= sizeof (char *);
+  *(char **) sp = NULL;
+  for (i = argc - 1; i >= 0; i--)
+    {
+      sp -= sizeof (char *);
+      *(char **) sp = argv[i];
+    }
+  sp -= sizeof (char **);
+  *(char ***) sp = (char **) (sp + sizeof (char **));
+  sp -= sizeof (int);
+  *(int *) sp = argc;
+  sp -= sizeof (void *);
+  *(void **) sp = NULL;
+
+  *esp = sp;
+  return true;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -463,3 +791,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
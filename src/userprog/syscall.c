@@ -1,20 +1,767 @@
 #include "userprog/syscall.h"
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <syscall-nr.h>
+#include <syscall-ring.h>
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/gdt.h"
+#include "userprog/process.h"
+#include "userprog/uaccess.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* A system call handler.  Receives the call's arguments, as
+   32-bit words, and returns the value for the caller's eax. */
+typedef int syscall_func (const uint32_t args[]);
+
+/* A system call table entry. */
+struct syscall
+  {
+    syscall_func *func;                 /* Handler, or null if none. */
+    int arg_cnt;                        /* Number of arguments. */
+  };
+
+/* Largest arg_cnt of any system call. */
+#define SYSCALL_MAX_ARGS 3
+
+static syscall_func sys_halt, sys_exit, sys_exec, sys_wait, sys_create,
+  sys_remove, sys_open, sys_filesize, sys_read, sys_write, sys_seek,
+  sys_tell, sys_close, sys_ring_enter, sys_fork;
+#ifdef VM
+static syscall_func sys_mmap, sys_munmap;
+#endif
+
+/* System calls, indexed by number.  Calls without a handler kill
+   the process that makes them. */
+static const struct syscall syscalls[] =
+  {
+    [SYS_HALT] = {sys_halt, 0},
+    [SYS_EXIT] = {sys_exit, 1},
+    [SYS_EXEC] = {sys_exec, 1},
+    [SYS_WAIT] = {sys_wait, 1},
+    [SYS_CREATE] = {sys_create, 2},
+    [SYS_REMOVE] = {sys_remove, 1},
+    [SYS_OPEN] = {sys_open, 1},
+    [SYS_FILESIZE] = {sys_filesize, 1},
+    [SYS_READ] = {sys_read, 3},
+    [SYS_WRITE] = {sys_write, 3},
+    [SYS_SEEK] = {sys_seek, 2},
+    [SYS_TELL] = {sys_tell, 1},
+    [SYS_CLOSE] = {sys_close, 1},
+#ifdef VM
+    [SYS_MMAP] = {sys_mmap, 2},
+    [SYS_MUNMAP] = {sys_munmap, 1},
+#endif
+    [SYS_RING_ENTER] = {sys_ring_enter, 2},
+    [SYS_FORK] = {sys_fork, 0},
+  };
+
+/* Number of entries in syscalls[]. */
+#define SYSCALL_CNT (sizeof syscalls / sizeof *syscalls)
+
+/* An open file, as seen by a process. */
+struct file_descriptor
+  {
+    struct list_elem elem;              /* Element in thread's files. */
+    int fd;                             /* File descriptor. */
+    struct file *file;                  /* Open file. */
+  };
+
+#ifdef VM
+/* A memory-mapped file. */
+struct mapping
+  {
+    struct list_elem elem;              /* Element in thread's mappings. */
+    int id;                             /* Mapping id. */
+    struct file *file;                  /* Mapped file, reopened. */
+    uint8_t *addr;                      /* First mapped page. */
+    size_t page_cnt;                    /* Number of mapped pages. */
+  };
+
+static void unmap (struct mapping *);
+#endif
+
+/* Serializes file system operations made by system calls and by
+   paging. */
+struct lock filesys_lock;
+
+/* Model-specific registers that configure SYSENTER.
+   See [IA32-v3a] 4.8.7 "Fast System Calls". */
+#define MSR_SYSENTER_CS 0x174   /* Kernel code selector. */
+#define MSR_SYSENTER_ESP 0x175  /* Kernel stack pointer. */
+#define MSR_SYSENTER_EIP 0x176  /* Kernel entry point. */
+
+/* True if user programs may make system calls with SYSENTER. */
+static bool sysenter_enabled;
 
 static void syscall_handler (struct intr_frame *);
+static int dispatch (const uint32_t *usp);
+static void exit_process (int status) NO_RETURN;
+static bool cpu_has_sysenter (void);
+static void wrmsr (uint32_t msr, uint64_t value);
 
+void sysenter_entry (void);
+int syscall_sysenter (const uint32_t *usp);
+
+/* Registers the "int $0x30" system call handler and, if the CPU
+   supports it, sets up SYSENTER as a faster alternative. */
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
+  lock_init (&filesys_lock);
+
+  if (cpu_has_sysenter ())
+    {
+      /* SYSENTER takes SS from the selector after CS, and SYSEXIT
+         takes the user selectors from the two after that, which
+         matches our GDT. */
+      wrmsr (MSR_SYSENTER_CS, SEL_KCSEG);
+      wrmsr (MSR_SYSENTER_EIP, (uintptr_t) sysenter_entry);
+      sysenter_enabled = true;
+      syscall_set_kernel_stack ((uint8_t *) thread_current () + PGSIZE);
+    }
+}
+
+/* Makes SYSENTER switch to kernel stack ESP0, which must be the
+   top of the running thread's stack.  Called on every thread
+   switch. */
+void
+syscall_set_kernel_stack (void *esp0)
+{
+  if (sysenter_enabled)
+    wrmsr (MSR_SYSENTER_ESP, (uintptr_t) esp0);
 }
 
+/* Unmaps every file the current process has mapped, writing
+   back modified pages, and closes every file it has open.
+   Called when the process exits. */
+void
+syscall_exit (void)
+{
+  struct thread *cur = thread_current ();
+
+#ifdef VM
+  while (!list_empty (&cur->mappings))
+    unmap (list_entry (list_front (&cur->mappings), struct mapping, elem));
+#endif
+
+  while (!list_empty (&cur->files))
+    {
+      struct file_descriptor *d = list_entry (list_pop_front (&cur->files),
+                                              struct file_descriptor, elem);
+      lock_acquire (&filesys_lock);
+      file_close (d->file);
+      lock_release (&filesys_lock);
+      free (d);
+    }
+}
+
+/* Handles a system call made with "int $0x30". */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+syscall_handler (struct intr_frame *f) 
+{
+  struct thread *cur = thread_current ();
+
+  cur->syscall_frame = f;
+  f->eax = dispatch (f->esp);
+  cur->syscall_frame = NULL;
+}
+
+/* Handles a system call made with SYSENTER.  Called by
+   sysenter_entry. */
+int
+syscall_sysenter (const uint32_t *usp)
+{
+  return dispatch (usp);
+}
+
+/* Looks up the system call number at user stack pointer USP in
+   syscalls[], copies its arguments with a single copy, and calls
+   its handler.  Returns the handler's result.  Kills the process
+   if the call does not exist or its arguments are not in valid
+   user memory. */
+static int
+dispatch (const uint32_t *usp)
+{
+  uint32_t args[SYSCALL_MAX_ARGS];
+  const struct syscall *sc;
+  uint32_t nr;
+
+  /* Remember the user stack pointer, so that kernel page faults
+     in user memory can tell whether the stack should grow. */
+  thread_current ()->user_esp = (void *) usp;
+
+  if (!copy_from_user (&nr, usp, sizeof nr)
+      || nr >= SYSCALL_CNT || syscalls[nr].func == NULL)
+    exit_process (-1);
+  sc = &syscalls[nr];
+  if (!copy_from_user (args, usp + 1, sc->arg_cnt * sizeof *args))
+    exit_process (-1);
+  return sc->func (args);
+}
+
+/* Gives the current process, which must be a new child of
+   PARENT, copies of each of PARENT's open file descriptors, with
+   the same numbers and file positions.  PARENT must not run
+   meanwhile.  Returns true if successful, false if memory is not
+   available. */
+bool
+syscall_inherit (struct thread *parent)
 {
-  printf ("system call!\n");
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&parent->files); e != list_end (&parent->files);
+       e = list_next (e))
+    {
+      struct file_descriptor *pd = list_entry (e, struct file_descriptor,
+                                               elem);
+      struct file_descriptor *d = malloc (sizeof *d);
+      if (d == NULL)
+        return false;
+      lock_acquire (&filesys_lock);
+      d->file = file_reopen (pd->file);
+      if (d->file != NULL)
+        file_seek (d->file, file_tell (pd->file));
+      lock_release (&filesys_lock);
+      if (d->file == NULL)
+        {
+          free (d);
+          return false;
+        }
+      d->fd = pd->fd;
+      list_push_back (&cur->files, &d->elem);
+    }
+  cur->next_fd = parent->next_fd;
+  return true;
+}
+
+/* Terminates the current process with the given exit STATUS. */
+static void
+exit_process (int status)
+{
+  thread_current ()->exit_status = status;
   thread_exit ();
 }
+
+/* Returns true if the CPU supports SYSENTER and SYSEXIT. */
+static bool
+cpu_has_sysenter (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+  int family, model, stepping;
+
+  asm ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+  family = (eax >> 8) & 0xf;
+  model = (eax >> 4) & 0xf;
+  stepping = eax & 0xf;
+
+  /* Feature bit 11 is SEP, but early Pentium Pros set it without
+     supporting the instructions. */
+  return (edx & (1 << 11)) != 0
+         && !(family == 6 && model < 3 && stepping < 3);
+}
+
+/* Writes VALUE to model-specific register MSR. */
+static void
+wrmsr (uint32_t msr, uint64_t value)
+{
+  asm volatile ("wrmsr" : : "c" (msr), "A" (value));
+}
+
+/* Copies the file name at user address UNAME into NAME.  Kills
+   the process if UNAME is invalid.  Returns false if the name is
+   too long to be the name of a file. */
+static bool
+get_file_name (char name[NAME_MAX + 1], const char *uname)
+{
+  int len = strncpy_from_user (name, uname, NAME_MAX + 1);
+  if (len < 0)
+    exit_process (-1);
+  return len <= NAME_MAX;
+}
+
+/* Returns the current process's file descriptor FD, or a null
+   pointer if FD is not open. */
+static struct file_descriptor *
+lookup_fd (int fd)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->files); e != list_end (&cur->files);
+       e = list_next (e))
+    {
+      struct file_descriptor *d = list_entry (e, struct file_descriptor, elem);
+      if (d->fd == fd)
+        return d;
+    }
+  return NULL;
+}
+
+/* halt(). */
+static int
+sys_halt (const uint32_t args[] UNUSED)
+{
+  shutdown_power_off ();
+}
+
+/* exit(STATUS). */
+static int
+sys_exit (const uint32_t args[])
+{
+  exit_process (args[0]);
+}
+
+/* exec(CMD_LINE). */
+static int
+sys_exec (const uint32_t args[])
+{
+  char *cmdline = palloc_get_page (0);
+  tid_t tid = TID_ERROR;
+  int len;
+
+  if (cmdline == NULL)
+    return TID_ERROR;
+  len = strncpy_from_user (cmdline, (const char *) args[0], PGSIZE);
+  if (len < 0)
+    {
+      palloc_free_page (cmdline);
+      exit_process (-1);
+    }
+  if (len < PGSIZE)
+    tid = process_execute (cmdline);
+  palloc_free_page (cmdline);
+  return tid;
+}
+
+/* wait(PID). */
+static int
+sys_wait (const uint32_t args[])
+{
+  return process_wait (args[0]);
+}
+
+/* create(FILE, INITIAL_SIZE). */
+static int
+sys_create (const uint32_t args[])
+{
+  char name[NAME_MAX + 1];
+  bool success;
+
+  if (!get_file_name (name, (const char *) args[0]))
+    return false;
+  lock_acquire (&filesys_lock);
+  success = filesys_create (name, args[1]);
+  lock_release (&filesys_lock);
+  return success;
+}
+
+/* remove(FILE). */
+static int
+sys_remove (const uint32_t args[])
+{
+  char name[NAME_MAX + 1];
+  bool success;
+
+  if (!get_file_name (name, (const char *) args[0]))
+    return false;
+  lock_acquire (&filesys_lock);
+  success = filesys_remove (name);
+  lock_release (&filesys_lock);
+  return success;
+}
+
+/* open(FILE). */
+static int
+sys_open (const uint32_t args[])
+{
+  struct thread *cur = thread_current ();
+  char name[NAME_MAX + 1];
+  struct file_descriptor *d;
+
+  if (!get_file_name (name, (const char *) args[0]))
+    return -1;
+  d = malloc (sizeof *d);
+  if (d == NULL)
+    return -1;
+  lock_acquire (&filesys_lock);
+  d->file = filesys_open (name);
+  lock_release (&filesys_lock);
+  if (d->file == NULL)
+    {
+      free (d);
+      return -1;
+    }
+  d->fd = cur->next_fd++;
+  list_push_back (&cur->files, &d->elem);
+  return d->fd;
+}
+
+/* filesize(FD). */
+static int
+sys_filesize (const uint32_t args[])
+{
+  struct file_descriptor *d = lookup_fd (args[0]);
+  int size;
+
+  if (d == NULL)
+    return -1;
+  lock_acquire (&filesys_lock);
+  size = file_length (d->file);
+  lock_release (&filesys_lock);
+  return size;
+}
+
+/* read(FD, BUFFER, SIZE).  Reads through a kernel page, a page
+   at a time. */
+static int
+sys_read (const uint32_t args[])
+{
+  uint8_t *ubuffer = (uint8_t *) args[1];
+  unsigned size = args[2];
+  struct file_descriptor *d = NULL;
+  unsigned done = 0;
+  uint8_t *page;
+
+  if (args[0] != STDIN_FILENO)
+    {
+      d = lookup_fd (args[0]);
+      if (d == NULL)
+        return -1;
+    }
+  page = palloc_get_page (0);
+  if (page == NULL)
+    return -1;
+
+  while (done < size)
+    {
+      unsigned chunk = size - done < PGSIZE ? size - done : PGSIZE;
+      unsigned n;
+
+      if (d == NULL)
+        {
+          for (n = 0; n < chunk; n++)
+            page[n] = input_getc ();
+        }
+      else
+        {
+          lock_acquire (&filesys_lock);
+          n = file_read (d->file, page, chunk);
+          lock_release (&filesys_lock);
+        }
+      if (!copy_to_user (ubuffer + done, page, n))
+        {
+          palloc_free_page (page);
+          exit_process (-1);
+        }
+      done += n;
+      if (n < chunk)
+        break;
+    }
+  palloc_free_page (page);
+  return done;
+}
+
+/* write(FD, BUFFER, SIZE).  Writes through a kernel page, a page
+   at a time. */
+static int
+sys_write (const uint32_t args[])
+{
+  const uint8_t *ubuffer = (const uint8_t *) args[1];
+  unsigned size = args[2];
+  struct file_descriptor *d = NULL;
+  unsigned done = 0;
+  uint8_t *page;
+
+  if (args[0] != STDOUT_FILENO)
+    {
+      d = lookup_fd (args[0]);
+      if (d == NULL)
+        return -1;
+    }
+  page = palloc_get_page (0);
+  if (page == NULL)
+    return -1;
+
+  while (done < size)
+    {
+      unsigned chunk = size - done < PGSIZE ? size - done : PGSIZE;
+      unsigned n;
+
+      if (!copy_from_user (page, ubuffer + done, chunk))
+        {
+          palloc_free_page (page);
+          exit_process (-1);
+        }
+      if (d == NULL)
+        {
+          putbuf ((const char *) page, chunk);
+          n = chunk;
+        }
+      else
+        {
+          lock_acquire (&filesys_lock);
+          n = file_write (d->file, page, chunk);
+          lock_release (&filesys_lock);
+        }
+      done += n;
+      if (n < chunk)
+        break;
+    }
+  palloc_free_page (page);
+  return done;
+}
+
+/* seek(FD, POSITION). */
+static int
+sys_seek (const uint32_t args[])
+{
+  struct file_descriptor *d = lookup_fd (args[0]);
+
+  if (d != NULL)
+    {
+      lock_acquire (&filesys_lock);
+      file_seek (d->file, args[1]);
+      lock_release (&filesys_lock);
+    }
+  return 0;
+}
+
+/* tell(FD). */
+static int
+sys_tell (const uint32_t args[])
+{
+  struct file_descriptor *d = lookup_fd (args[0]);
+  int position;
+
+  if (d == NULL)
+    return -1;
+  lock_acquire (&filesys_lock);
+  position = file_tell (d->file);
+  lock_release (&filesys_lock);
+  return position;
+}
+
+/* close(FD). */
+static int
+sys_close (const uint32_t args[])
+{
+  struct file_descriptor *d = lookup_fd (args[0]);
+
+  if (d != NULL)
+    {
+      list_remove (&d->elem);
+      lock_acquire (&filesys_lock);
+      file_close (d->file);
+      lock_release (&filesys_lock);
+      free (d);
+    }
+  return 0;
+}
+
+/* fork().  Only possible for calls made with "int $0x30",
+   whose interrupt frame holds all of the user registers that the
+   child must start with, and only without VM; see
+   process_fork(). */
+static int
+sys_fork (const uint32_t args[] UNUSED)
+{
+  struct intr_frame *f = thread_current ()->syscall_frame;
+
+  return f != NULL ? process_fork (f) : TID_ERROR;
+}
+
+#ifdef VM
+/* mmap(FD, ADDR).  Maps the file open as FD at ADDR, page by
+   page, without reading any of it; pages are read from the file
+   as they are touched. */
+static int
+sys_mmap (const uint32_t args[])
+{
+  struct thread *cur = thread_current ();
+  struct file_descriptor *d = lookup_fd (args[0]);
+  uint8_t *addr = (uint8_t *) args[1];
+  struct mapping *m;
+  off_t length;
+  size_t i;
+
+  if (d == NULL || addr == NULL || !is_user_vaddr (addr)
+      || pg_ofs (addr) != 0)
+    return -1;
+  lock_acquire (&filesys_lock);
+  length = file_length (d->file);
+  lock_release (&filesys_lock);
+  if (length == 0)
+    return -1;
+
+  /* The mapping must fit in user memory without overlapping any
+     page the process already has. */
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return -1;
+  m->addr = addr;
+  m->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  if (m->page_cnt > (size_t) ((uint8_t *) PHYS_BASE - addr) / PGSIZE)
+    {
+      free (m);
+      return -1;
+    }
+  for (i = 0; i < m->page_cnt; i++)
+    if (page_lookup (addr + i * PGSIZE) != NULL)
+      {
+        free (m);
+        return -1;
+      }
+
+  /* Reopen the file, so that the mapping survives close(). */
+  lock_acquire (&filesys_lock);
+  m->file = file_reopen (d->file);
+  lock_release (&filesys_lock);
+  if (m->file == NULL)
+    {
+      free (m);
+      return -1;
+    }
+
+  for (i = 0; i < m->page_cnt; i++)
+    {
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+      if (!page_add_mapped (addr + ofs, m->file, ofs, read_bytes))
+        {
+          m->page_cnt = i;
+          list_push_back (&cur->mappings, &m->elem);
+          unmap (m);
+          return -1;
+        }
+    }
+
+  m->id = cur->next_mapid++;
+  list_push_back (&cur->mappings, &m->elem);
+  return m->id;
+}
+
+/* munmap(MAPPING). */
+static int
+sys_munmap (const uint32_t args[])
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->mappings); e != list_end (&cur->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == (int) args[0])
+        {
+          unmap (m);
+          break;
+        }
+    }
+  return 0;
+}
+
+/* Removes mapping M from the current process, writing modified
+   pages back to the file, and frees it. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (m->addr + i * PGSIZE);
+  list_remove (&m->elem);
+  lock_acquire (&filesys_lock);
+  file_close (m->file);
+  lock_release (&filesys_lock);
+  free (m);
+}
+#endif
+
+/* Carries out the operation described by SQE, which must be in
+   kernel memory, and returns its result. */
+static int
+run_sqe (const struct ring_sqe *sqe)
+{
+  uint32_t args[SYSCALL_MAX_ARGS];
+
+  args[0] = sqe->fd;
+  switch (sqe->opcode)
+    {
+    case RING_OP_NOP:
+      return 0;
+    case RING_OP_READ:
+      args[1] = (uint32_t) sqe->buffer;
+      args[2] = sqe->size;
+      return sys_read (args);
+    case RING_OP_WRITE:
+      args[1] = (uint32_t) sqe->buffer;
+      args[2] = sqe->size;
+      return sys_write (args);
+    case RING_OP_SEEK:
+      args[1] = sqe->position;
+      return sys_seek (args);
+    case RING_OP_CLOSE:
+      return sys_close (args);
+    default:
+      return -1;
+    }
+}
+
+/* ring_enter(RING, TO_SUBMIT).  Runs up to TO_SUBMIT operations
+   from RING's submission queue, in order, and posts a completion
+   for each.  Stops early if the submission queue empties or the
+   completion queue fills.  Returns the number of operations
+   run. */
+static int
+sys_ring_enter (const uint32_t args[])
+{
+  struct ring *uring = (struct ring *) args[0];
+  unsigned to_submit = args[1];
+  uint32_t sq_head, sq_tail, cq_head, cq_tail;
+  unsigned done;
+
+  if (!copy_from_user (&sq_head, &uring->sq_head, sizeof sq_head)
+      || !copy_from_user (&sq_tail, &uring->sq_tail, sizeof sq_tail)
+      || !copy_from_user (&cq_head, &uring->cq_head, sizeof cq_head)
+      || !copy_from_user (&cq_tail, &uring->cq_tail, sizeof cq_tail))
+    exit_process (-1);
+
+  for (done = 0; done < to_submit && sq_head != sq_tail
+         && cq_tail - cq_head < RING_ENTRIES; done++)
+    {
+      struct ring_sqe sqe;
+      struct ring_cqe cqe;
+
+      if (!copy_from_user (&sqe, &uring->sq[sq_head % RING_ENTRIES],
+                           sizeof sqe))
+        exit_process (-1);
+      cqe.user_data = sqe.user_data;
+      cqe.result = run_sqe (&sqe);
+      if (!copy_to_user (&uring->cq[cq_tail % RING_ENTRIES], &cqe,
+                         sizeof cqe))
+        exit_process (-1);
+      sq_head++;
+      cq_tail++;
+    }
+
+  if (!copy_to_user (&uring->sq_head, &sq_head, sizeof sq_head)
+      || !copy_to_user (&uring->cq_tail, &cq_tail, sizeof cq_tail))
+    exit_process (-1);
+  return done;
+}
@@ -1,6 +1,19 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+#include "threads/synch.h"
+
+struct thread;
+
+/* Serializes file system operations made by system calls and by
+   paging.  Never held while touching user memory, so that a page
+   fault can always acquire it. */
+extern struct lock filesys_lock;
+
 void syscall_init (void);
+void syscall_exit (void);
+bool syscall_inherit (struct thread *parent);
+void syscall_set_kernel_stack (void *esp0);
 
 #endif /* userprog/syscall.h */
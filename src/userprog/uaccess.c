@@ -0,0 +1,136 @@
+#include "userprog/uaccess.h"
+#include <stdint.h>
+#include "threads/interrupt.h"
+#include "threads/vaddr.h"
+
+/* Copying data between the kernel and user memory.
+
+   Every process's page directory maps user memory as well as the
+   kernel, so the kernel can access a user buffer directly, but a
+   bad pointer passed by a user program must not crash the
+   kernel.  Instead of looking up every page of a user buffer
+   with pagedir_get_page() beforehand, the functions below simply
+   do the access.  Each instruction in them that touches user
+   memory is listed in the exception table, the __ex_table
+   section, along with a "fixup" address.  If such an instruction
+   page faults, page_fault() calls uaccess_fixup(), which resumes
+   execution at the fixup address, and the function reports
+   failure.  Thus, valid pointers, the common case, cost nothing
+   beyond the copy itself.
+
+   User addresses must still be checked against PHYS_BASE,
+   because kernel memory is mapped too, and the kernel may
+   access it without faulting. */
+
+/* An exception table entry. */
+struct exception_entry
+  {
+    uintptr_t insn;             /* Instruction that may fault. */
+    uintptr_t fixup;            /* Where to continue if it does. */
+  };
+
+/* The exception table, delimited by the linker script. */
+extern const struct exception_entry __start_ex_table[], __stop_ex_table[];
+
+/* Returns true if the SIZE bytes starting at UADDR all lie in
+   user virtual memory. */
+static inline bool
+is_user_range (const void *uaddr, size_t size)
+{
+  return ((uintptr_t) uaddr < (uintptr_t) PHYS_BASE
+          && size <= (uintptr_t) PHYS_BASE - (uintptr_t) uaddr);
+}
+
+/* Copies SIZE bytes from SRC to DST, either of which may be in
+   user memory, and returns the number of bytes left uncopied
+   because of a page fault. */
+static size_t
+copy_bytes (void *dst, const void *src, size_t size)
+{
+  asm volatile ("1: rep movsb\n"
+                "2:\n"
+                ".section __ex_table, \"a\"\n"
+                "  .long 1b, 2b\n"
+                ".previous"
+                : "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+  return size;
+}
+
+/* Reads the byte at user address UADDR.  Returns the byte if
+   successful, -1 if the read faulted. */
+static inline int
+get_user (const uint8_t *uaddr)
+{
+  int result = -1;
+  asm volatile ("1: movzbl %1, %0\n"
+                "2:\n"
+                ".section __ex_table, \"a\"\n"
+                "  .long 1b, 2b\n"
+                ".previous"
+                : "+r" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Copies SIZE bytes from user address USRC to DST.  Returns true
+   if successful, false if any part of USRC is not valid user
+   memory, in which case DST's contents are unspecified. */
+bool
+copy_from_user (void *dst, const void *usrc, size_t size)
+{
+  return is_user_range (usrc, size) && copy_bytes (dst, usrc, size) == 0;
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.  Returns true
+   if successful, false if any part of UDST is not valid,
+   writable user memory, in which case part of it may have been
+   written. */
+bool
+copy_to_user (void *udst, const void *src, size_t size)
+{
+  return is_user_range (udst, size) && copy_bytes (udst, src, size) == 0;
+}
+
+/* Copies the null-terminated string at user address USRC into
+   DST, which has room for SIZE bytes.  Returns the string's
+   length if it fits in DST, along with its null terminator; SIZE
+   if it does not, in which case DST is not null-terminated; or
+   -1 if USRC is not valid user memory. */
+int
+strncpy_from_user (char *dst, const char *usrc, size_t size)
+{
+  const uint8_t *u = (const uint8_t *) usrc;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    {
+      int c;
+
+      if (!is_user_range (u + i, 1))
+        return -1;
+      c = get_user (u + i);
+      if (c < 0)
+        return -1;
+      dst[i] = c;
+      if (c == '\0')
+        return i;
+    }
+  return size;
+}
+
+/* Called by the page fault handler for a fault in kernel mode.
+   If F's instruction is in the exception table, makes F resume
+   at its fixup address and returns true.  Otherwise, returns
+   false: the fault is a kernel bug. */
+bool
+uaccess_fixup (struct intr_frame *f)
+{
+  const struct exception_entry *e;
+
+  for (e = __start_ex_table; e < __stop_ex_table; e++)
+    if (e->insn == (uintptr_t) f->eip)
+      {
+        f->eip = (void (*) (void)) e->fixup;
+        return true;
+      }
+  return false;
+}
@@ -0,0 +1,178 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Every frame that holds a user page, in clock order. */
+static struct list frames;
+
+/* Clock hand: the next frame to consider for eviction, or
+   list_end (&frames) to start over from the beginning. */
+static struct list_elem *hand;
+
+/* Protects the frame table and the frame-related members of
+   every struct page. */
+static struct lock frames_lock;
+
+/* Signaled, with frames_lock, whenever a page stops being in
+   transit. */
+static struct condition transit_cond;
+
+static struct frame *choose_victim (void);
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  list_init (&frames);
+  hand = list_end (&frames);
+  lock_init (&frames_lock);
+  cond_init (&transit_cond);
+}
+
+/* Obtains a frame for page P, evicting another page if the user
+   pool is exhausted and MAY_EVICT is true.  The frame is
+   returned pinned, so that it cannot be evicted before P is in
+   place; the caller must unpin it with frame_unpin().
+   Returns a null pointer if no frame can be had.
+
+   Eviction writes the victim out without holding the frame table
+   lock, with the victim's frame pinned and the victim marked in
+   transit, so that other threads can keep faulting meanwhile and
+   the victim's owner waits for it instead of finding it half
+   gone. */
+struct frame *
+frame_alloc (struct page *p, bool may_evict)
+{
+  struct frame *f = NULL;
+  void *kpage;
+
+  lock_acquire (&frames_lock);
+  kpage = palloc_get_page (PAL_USER);
+  if (kpage != NULL)
+    {
+      f = malloc (sizeof *f);
+      if (f != NULL)
+        {
+          f->kpage = kpage;
+          list_push_back (&frames, &f->elem);
+        }
+      else
+        palloc_free_page (kpage);
+    }
+  else if (may_evict)
+    {
+      f = choose_victim ();
+      if (f != NULL)
+        {
+          struct page *victim = f->page;
+          bool evicted;
+
+          f->pinned = true;
+          victim->in_transit = true;
+          lock_release (&frames_lock);
+          evicted = page_evict (victim);
+          lock_acquire (&frames_lock);
+          victim->in_transit = false;
+          cond_broadcast (&transit_cond, &frames_lock);
+          if (!evicted)
+            {
+              f->pinned = false;
+              f = NULL;
+            }
+        }
+    }
+
+  if (f != NULL)
+    {
+      f->page = p;
+      f->pinned = true;
+    }
+  lock_release (&frames_lock);
+  return f;
+}
+
+/* Makes F eligible for eviction. */
+void
+frame_unpin (struct frame *f)
+{
+  lock_acquire (&frames_lock);
+  ASSERT (f->pinned);
+  f->pinned = false;
+  lock_release (&frames_lock);
+}
+
+/* Removes F from the frame table and frees it and its memory.
+   The caller must hold the frame table lock and must already
+   have unmapped F's page. */
+void
+frame_free (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frames_lock));
+
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/* Acquires the frame table lock, which the caller must hold to
+   examine or change the frame of a page that may be evicted. */
+void
+frame_table_lock (void)
+{
+  lock_acquire (&frames_lock);
+}
+
+/* Releases the frame table lock. */
+void
+frame_table_unlock (void)
+{
+  lock_release (&frames_lock);
+}
+
+/* Waits, with the frame table lock held, until some page stops
+   being in transit.  The caller should check its page again
+   afterward. */
+void
+frame_table_wait (void)
+{
+  cond_wait (&transit_cond, &frames_lock);
+}
+
+/* Chooses a frame to evict with the clock algorithm: sweeps the
+   frame table from the clock hand, giving each recently accessed
+   page a second chance by clearing its accessed bit, and stops at
+   the first unpinned frame whose page has not been accessed
+   since the last sweep.  Returns a null pointer if every frame is
+   pinned. */
+static struct frame *
+choose_victim (void)
+{
+  size_t i, n = list_size (&frames);
+
+  for (i = 0; i < 2 * n; i++)
+    {
+      struct frame *f;
+      uint32_t *pd;
+
+      if (hand == list_end (&frames))
+        hand = list_begin (&frames);
+      f = list_entry (hand, struct frame, elem);
+      hand = list_next (hand);
+
+      if (f->pinned)
+        continue;
+      pd = f->page->thread->pagedir;
+      if (pagedir_is_accessed (pd, f->page->addr))
+        pagedir_set_accessed (pd, f->page->addr, false);
+      else
+        return f;
+    }
+  return NULL;
+}
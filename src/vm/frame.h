@@ -0,0 +1,28 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdbool.h>
+
+struct page;
+
+/* A frame of physical memory in the user pool, holding a page of
+   some process. */
+struct frame
+  {
+    struct list_elem elem;              /* Element in frame table. */
+    void *kpage;                        /* Kernel virtual address. */
+    struct page *page;                  /* Page held in this frame. */
+    bool pinned;                        /* Exempt from eviction? */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *, bool may_evict);
+void frame_unpin (struct frame *);
+void frame_free (struct frame *);
+
+void frame_table_lock (void);
+void frame_table_unlock (void);
+void frame_table_wait (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,596 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Maximum size of a process's stack, in bytes. */
+size_t page_stack_max = 8 * 1024 * 1024;
+
+/* PUSHA writes this many bytes below the stack pointer before
+   updating it, so faults that far below it are still stack
+   accesses. */
+#define PUSHA_BYTES 32
+
+/* A page of zeros, mapped read-only into every process for
+   each all-zero page that it has read but not yet written. */
+static void *zero_page;
+
+/* Statistics. */
+static long long zero_map_cnt;  /* # of pages mapped to zero_page. */
+static long long zero_copy_cnt; /* # of those later written. */
+static long long around_cnt;    /* # of pages brought in ahead. */
+
+/* Most pages that one fault brings in beyond the faulting
+   page. */
+#define FAULT_AROUND_MAX 8
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_free;
+static struct page *add_page (void *upage, struct file *, off_t,
+                              size_t read_bytes, bool writable);
+static bool load_page (struct page *, bool write, bool may_evict);
+static bool map_frame (struct page *, struct frame *, bool dirty);
+static void discard_frame (struct frame *);
+static void fault_around (struct page *, bool write);
+static bool is_whole_file_page (const struct page *);
+static bool read_ahead (struct page **, size_t cnt, int dir);
+static void release_page (struct page *);
+static void write_back (struct page *);
+
+/* Initializes the paging code. */
+void
+page_init (void)
+{
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+}
+
+/* Prints paging statistics.  Every zero page mapping that was
+   never written saved a frame, and every page brought in by
+   fault-around saved a fault. */
+void
+page_print_stats (void)
+{
+  printf ("Paging: %lld zero page maps, %lld written, %lld frames saved\n",
+          zero_map_cnt, zero_copy_cnt, zero_map_cnt - zero_copy_cnt);
+  printf ("Paging: %lld pages brought in by fault-around\n", around_cnt);
+}
+
+/* Creates an empty supplemental page table for the current
+   thread.  Returns true if successful, false if memory could not
+   be allocated. */
+bool
+page_table_create (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->pages == NULL);
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    return false;
+  if (!hash_init (t->pages, page_hash, page_less, NULL))
+    {
+      free (t->pages);
+      t->pages = NULL;
+      return false;
+    }
+  return true;
+}
+
+/* Destroys the current thread's supplemental page table, if it
+   has one, and frees the frames and swap slots of its pages. */
+void
+page_table_destroy (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->pages != NULL)
+    {
+      hash_destroy (t->pages, page_free);
+      free (t->pages);
+      t->pages = NULL;
+    }
+}
+
+/* Records that user page UPAGE in the current process is to be
+   filled, when first touched, with READ_BYTES bytes from FILE
+   starting at OFS followed by zeros, or entirely with zeros if
+   READ_BYTES is 0.  FILE must stay open as long as the page
+   exists.  The process may write the page only if WRITABLE is
+   true.
+   Returns true if successful, false if UPAGE is already in use
+   or memory could not be allocated. */
+bool
+page_add (void *upage, struct file *file, off_t ofs, size_t read_bytes,
+          bool writable)
+{
+  return add_page (upage, file, ofs, read_bytes, writable) != NULL;
+}
+
+/* Records that user page UPAGE in the current process maps
+   READ_BYTES bytes of FILE starting at OFS, followed by zeros.
+   The page is read from FILE when first touched, and if the
+   process modifies it, written back to FILE when it is evicted
+   or removed.  FILE must stay open as long as the page exists.
+   Returns true if successful, false if UPAGE is already in use
+   or memory could not be allocated. */
+bool
+page_add_mapped (void *upage, struct file *file, off_t ofs,
+                 size_t read_bytes)
+{
+  struct page *p;
+
+  ASSERT (file != NULL && read_bytes > 0);
+
+  p = add_page (upage, file, ofs, read_bytes, true);
+  if (p == NULL)
+    return false;
+  p->mapped = true;
+  return true;
+}
+
+/* Removes the current process's page UPAGE, which must exist,
+   writing it back to its file first if it is a modified page of
+   a memory-mapped file. */
+void
+page_remove (void *upage)
+{
+  struct page *p = page_lookup (upage);
+
+  ASSERT (p != NULL);
+  hash_delete (thread_current ()->pages, &p->hash_elem);
+  release_page (p);
+}
+
+/* Returns the current process's page that contains ADDR, or a
+   null pointer if there is none. */
+struct page *
+page_lookup (const void *addr)
+{
+  struct thread *t = thread_current ();
+  struct page p;
+  struct hash_elem *e;
+
+  if (t->pages == NULL)
+    return NULL;
+  p.addr = pg_round_down (addr);
+  e = hash_find (t->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Handles a fault by the current process at FAULT_ADDR, which
+   was a write if WRITE is true, a read otherwise.  Brings in the
+   page if it is not present and maps it.  An all-zero page that
+   is only read is mapped to the shared zero page; the first
+   write to it gets it a frame of its own.  Then, if recent
+   faults have been sequential, brings in the next pages in the
+   same direction too.
+   Returns true if successful, false if the address is not part
+   of the process's address space, the access is not allowed, or
+   the page could not be brought in. */
+bool
+page_in (const void *fault_addr, bool write)
+{
+  struct thread *t = thread_current ();
+  struct page *p = page_lookup (fault_addr);
+  bool present;
+
+  if (p == NULL)
+    return false;
+
+  /* If another thread is evicting P, wait for it to finish.  If
+     the eviction failed, P is back in its frame and the access
+     may simply be retried. */
+  frame_table_lock ();
+  while (p->in_transit)
+    frame_table_wait ();
+  present = p->frame != NULL;
+  frame_table_unlock ();
+
+  if (p->zero_mapped)
+    {
+      /* First write to a page that still shares the zero
+         page. */
+      if (!write || !p->writable)
+        return false;
+      pagedir_clear_page (t->pagedir, p->addr);
+      p->zero_mapped = false;
+      zero_copy_cnt++;
+    }
+  else if (present)
+    return !write || p->writable;
+
+  if (!load_page (p, write, true))
+    return false;
+  fault_around (p, write);
+  return true;
+}
+
+/* Brings in page P, which must not be present, for an access
+   that is a write if WRITE is true, a read otherwise, and maps
+   it.  If MAY_EVICT is false, uses only a free frame.
+   Returns true if successful, false on failure. */
+static bool
+load_page (struct page *p, bool write, bool may_evict)
+{
+  struct thread *t = thread_current ();
+  struct frame *f;
+  bool dirty = false;
+
+  if (!write && p->file == NULL && p->swap_slot == SWAP_ERROR)
+    {
+      if (!pagedir_set_page (t->pagedir, p->addr, zero_page, false))
+        return false;
+      p->zero_mapped = true;
+      zero_map_cnt++;
+      return true;
+    }
+
+  /* Nothing else touches P while it is not present, so its
+     contents can be read without holding the frame table lock.
+     F is pinned until P is mapped. */
+  f = frame_alloc (p, may_evict);
+  if (f == NULL)
+    return false;
+  if (p->swap_slot != SWAP_ERROR)
+    {
+      /* The copy in swap is the only one, so the page must go
+         back to swap if it is evicted again. */
+      swap_in (p->swap_slot, f->kpage);
+      p->swap_slot = SWAP_ERROR;
+      dirty = true;
+    }
+  else
+    {
+      if (p->file != NULL)
+        {
+          off_t n;
+
+          lock_acquire (&filesys_lock);
+          n = file_read_at (p->file, f->kpage, p->read_bytes, p->file_ofs);
+          lock_release (&filesys_lock);
+          if (n != (off_t) p->read_bytes)
+            {
+              discard_frame (f);
+              return false;
+            }
+        }
+      memset ((uint8_t *) f->kpage + p->read_bytes, 0,
+              PGSIZE - p->read_bytes);
+    }
+  return map_frame (p, f, dirty);
+}
+
+/* Maps page P to frame F, which holds P's contents, marking it
+   dirty if DIRTY is true, and unpins F.  Returns true if
+   successful.  On failure, frees F and returns false. */
+static bool
+map_frame (struct page *p, struct frame *f, bool dirty)
+{
+  struct thread *t = thread_current ();
+
+  if (!pagedir_set_page (t->pagedir, p->addr, f->kpage, p->writable))
+    {
+      discard_frame (f);
+      return false;
+    }
+  if (dirty)
+    pagedir_set_dirty (t->pagedir, p->addr, true);
+  p->frame = f;
+  frame_unpin (f);
+  return true;
+}
+
+/* Frees pinned frame F, whose page never got mapped. */
+static void
+discard_frame (struct frame *f)
+{
+  frame_table_lock ();
+  frame_free (f);
+  frame_table_unlock ();
+}
+
+/* Updates the current thread's fault history for a fault on
+   page P, which was a write if WRITE is true, and brings in up
+   to fault_window more pages after P in the direction of recent
+   faults.  Each fault right after the previous one's pages, in
+   the same direction, doubles the window up to FAULT_AROUND_MAX;
+   any other fault closes it.  Pages are brought in only while
+   they are not present and a free frame is available, so fault-
+   around never evicts.  Runs of whole pages that lie next to
+   each other in the same file are read with a single I/O. */
+static void
+fault_around (struct page *p, bool write)
+{
+  struct thread *t = thread_current ();
+  struct page *run[FAULT_AROUND_MAX];
+  uint8_t *addr = p->addr;
+  int dir = 0;
+  size_t cnt, i;
+
+  if (t->fault_last != NULL && addr == t->fault_last + PGSIZE)
+    dir = 1;
+  else if (t->fault_last != NULL && addr == t->fault_last - PGSIZE)
+    dir = -1;
+
+  if (dir == 0)
+    t->fault_window = 0;
+  else if (dir != t->fault_dir || t->fault_window == 0)
+    t->fault_window = 1;
+  else if (t->fault_window < FAULT_AROUND_MAX)
+    t->fault_window *= 2;
+  t->fault_dir = dir;
+
+  /* Collect the pages to bring in, stopping at any page that is
+     present or being evicted.  A page without a frame cannot
+     start being evicted, so the pages collected stay absent
+     after the lock is released. */
+  frame_table_lock ();
+  for (cnt = 0; cnt < t->fault_window; cnt++)
+    {
+      struct page *q;
+
+      addr += dir * PGSIZE;
+      q = page_lookup (addr);
+      if (q == NULL || q->in_transit || q->frame != NULL || q->zero_mapped)
+        break;
+      run[cnt] = q;
+    }
+  frame_table_unlock ();
+  t->fault_last = cnt > 0 ? run[cnt - 1]->addr : p->addr;
+
+  /* Bring them in. */
+  for (i = 0; i < cnt; )
+    {
+      size_t n = 1;
+
+      if (is_whole_file_page (run[i]))
+        while (i + n < cnt
+               && is_whole_file_page (run[i + n])
+               && run[i + n]->file == run[i]->file
+               && run[i + n]->file_ofs
+                  == run[i + n - 1]->file_ofs + dir * PGSIZE)
+          n++;
+      if (n > 1 ? !read_ahead (run + i, n, dir)
+                : !load_page (run[i], write, false))
+        break;
+      around_cnt += n;
+      i += n;
+    }
+}
+
+/* Returns true if P is not present and takes a whole page from
+   its file. */
+static bool
+is_whole_file_page (const struct page *p)
+{
+  return p->file != NULL && p->swap_slot == SWAP_ERROR
+         && p->read_bytes == PGSIZE;
+}
+
+/* Brings in the CNT pages in RUN, which are whole pages that lie
+   next to each other in the same file, in direction DIR from one
+   to the next, with a single read into a bounce buffer.  Uses
+   only free frames.  Returns true if successful, false if any of
+   the pages could not be brought in. */
+static bool
+read_ahead (struct page **run, size_t cnt, int dir)
+{
+  struct frame *frames[FAULT_AROUND_MAX];
+  off_t first_ofs = dir > 0 ? run[0]->file_ofs : run[cnt - 1]->file_ofs;
+  off_t size = cnt * PGSIZE;
+  uint8_t *buffer;
+  off_t n;
+  bool success = false;
+  size_t i, frame_cnt;
+
+  ASSERT (cnt <= FAULT_AROUND_MAX);
+
+  buffer = palloc_get_multiple (0, cnt);
+  if (buffer == NULL)
+    return false;
+  for (frame_cnt = 0; frame_cnt < cnt; frame_cnt++)
+    {
+      frames[frame_cnt] = frame_alloc (run[frame_cnt], false);
+      if (frames[frame_cnt] == NULL)
+        goto done;
+    }
+  lock_acquire (&filesys_lock);
+  n = file_read_at (run[0]->file, buffer, size, first_ofs);
+  lock_release (&filesys_lock);
+  if (n != size)
+    goto done;
+
+  success = true;
+  for (i = 0; i < cnt; i++)
+    {
+      memcpy (frames[i]->kpage, buffer + (run[i]->file_ofs - first_ofs),
+              PGSIZE);
+      if (!map_frame (run[i], frames[i], false))
+        success = false;
+    }
+  frame_cnt = 0;
+
+ done:
+  for (i = 0; i < frame_cnt; i++)
+    discard_frame (frames[i]);
+  palloc_free_multiple (buffer, cnt);
+  return success;
+}
+
+/* Evicts page P from its frame.  If P has been modified, writes
+   it back to its file if it belongs to a memory-mapped file, or
+   to swap otherwise.  The caller must have pinned P's frame and
+   marked P in transit, which gives it P's frame-related members,
+   and must not hold the frame table lock, so that other threads
+   are not held up by the I/O.
+   Returns true if successful, false if P must go to swap and
+   swap is full, in which case P stays where it is. */
+bool
+page_evict (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+
+  ASSERT (p->frame != NULL && p->in_transit);
+
+  /* Unmap P first, so that its owner cannot modify it behind our
+     back.  Clearing the mapping keeps the dirty bit. */
+  pagedir_clear_page (pd, p->addr);
+  if (p->mapped)
+    write_back (p);
+  else if (pagedir_is_dirty (pd, p->addr))
+    {
+      p->swap_slot = swap_out (p->frame->kpage);
+      if (p->swap_slot == SWAP_ERROR)
+        {
+          pagedir_set_page (pd, p->addr, p->frame->kpage, p->writable);
+          pagedir_set_dirty (pd, p->addr, true);
+          return false;
+        }
+    }
+  p->frame = NULL;
+  return true;
+}
+
+/* Adds a zero-filled page at FAULT_ADDR to the current
+   process's stack, if FAULT_ADDR is not already in its address
+   space but looks like a stack access for user stack pointer
+   ESP: at most PUSHA_BYTES below ESP and within page_stack_max
+   bytes of the top of user memory.  The page is not brought in
+   here.
+   Returns true if a page was added, false otherwise. */
+bool
+page_grow_stack (const void *fault_addr, const void *esp)
+{
+  const uint8_t *addr = fault_addr;
+
+  if (addr >= (uint8_t *) PHYS_BASE
+      || addr < (uint8_t *) PHYS_BASE - page_stack_max
+      || addr < (const uint8_t *) esp - PUSHA_BYTES
+      || page_lookup (addr) != NULL)
+    return false;
+  return page_add (pg_round_down (addr), NULL, 0, 0, true);
+}
+
+/* Returns a hash value for page P. */
+static unsigned
+page_hash (const struct hash_elem *p_, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (p_, struct page, hash_elem);
+  return hash_bytes (&p->addr, sizeof p->addr);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  return a->addr < b->addr;
+}
+
+/* Frees page P. */
+static void
+page_free (struct hash_elem *p_, void *aux UNUSED)
+{
+  release_page (hash_entry (p_, struct page, hash_elem));
+}
+
+/* Creates a page for UPAGE in the current process, as described
+   for page_add(), and returns it.  Returns a null pointer if
+   UPAGE is already in use or memory could not be allocated. */
+static struct page *
+add_page (void *upage, struct file *file, off_t ofs, size_t read_bytes,
+          bool writable)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->addr = upage;
+  p->thread = t;
+  p->writable = writable;
+  p->frame = NULL;
+  p->swap_slot = SWAP_ERROR;
+  p->in_transit = false;
+  p->file = read_bytes > 0 ? file : NULL;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->mapped = false;
+  p->zero_mapped = false;
+
+  if (hash_insert (t->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Unmaps page P, which has already been taken out of its
+   thread's page table, writes it back if it is a modified page
+   of a memory-mapped file, and frees it along with its frame or
+   swap slot.  Waits first if P is being evicted. */
+static void
+release_page (struct page *p)
+{
+  frame_table_lock ();
+  while (p->in_transit)
+    frame_table_wait ();
+  if (p->frame != NULL)
+    {
+      struct frame *f = p->frame;
+
+      pagedir_clear_page (p->thread->pagedir, p->addr);
+      if (p->mapped)
+        {
+          /* Keep F from being evicted while it is written back
+             without the frame table lock. */
+          f->pinned = true;
+          frame_table_unlock ();
+          write_back (p);
+          frame_table_lock ();
+        }
+      frame_free (f);
+    }
+  else if (p->zero_mapped)
+    pagedir_clear_page (p->thread->pagedir, p->addr);
+  else if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+  frame_table_unlock ();
+  free (p);
+}
+
+/* Writes memory-mapped page P, which must be in a pinned frame
+   but no longer mapped, back to its file if the process modified
+   it.  The caller must not hold the frame table lock.
+   Clean pages need no I/O at all.  Only the part of the page
+   that lies within the file is written, so the file does not
+   grow. */
+static void
+write_back (struct page *p)
+{
+  ASSERT (p->mapped && p->frame != NULL);
+
+  if (pagedir_is_dirty (p->thread->pagedir, p->addr))
+    {
+      lock_acquire (&filesys_lock);
+      file_write_at (p->file, p->frame->kpage, p->read_bytes, p->file_ofs);
+      lock_release (&filesys_lock);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct frame;
+
+/* A page of a process's virtual memory, recorded when the page
+   is set up and consulted when the process first touches it.
+   Entries live in the owning thread's supplemental page
+   table. */
+struct page
+  {
+    struct hash_elem hash_elem;         /* Element in thread's pages. */
+    void *addr;                         /* User virtual address. */
+    struct thread *thread;              /* Owning thread. */
+    bool writable;                      /* May the process write it? */
+
+    /* Where the page is now.  Protected by the frame table
+       lock, except that while IN_TRANSIT is true they belong to
+       the thread evicting the page, and anyone else must wait
+       with frame_table_wait(). */
+    struct frame *frame;                /* Frame, or null if not present. */
+    size_t swap_slot;                   /* Swap slot, or SWAP_ERROR. */
+    bool in_transit;                    /* Being evicted? */
+
+    /* Where the page's contents come from.  The first READ_BYTES
+       bytes are read from FILE at FILE_OFS and the rest of the
+       page is zeroed.  FILE is null for an all-zero page.  Once
+       the process modifies the page, it comes from swap instead,
+       unless the page belongs to a memory-mapped file, in which
+       case changes are written back to FILE. */
+    struct file *file;                  /* File, or null. */
+    off_t file_ofs;                     /* Offset in FILE. */
+    size_t read_bytes;                  /* Bytes to read from FILE. */
+    bool mapped;                        /* Part of a memory mapping? */
+    bool zero_mapped;                   /* Sharing the zero page? */
+  };
+
+/* Maximum size of a process's stack, in bytes.  Set with
+   -stack. */
+extern size_t page_stack_max;
+
+void page_init (void);
+void page_print_stats (void);
+
+bool page_table_create (void);
+void page_table_destroy (void);
+
+bool page_add (void *upage, struct file *, off_t, size_t read_bytes,
+               bool writable);
+bool page_add_mapped (void *upage, struct file *, off_t, size_t read_bytes);
+void page_remove (void *upage);
+struct page *page_lookup (const void *addr);
+bool page_in (const void *fault_addr, bool write);
+bool page_evict (struct page *);
+bool page_grow_stack (const void *fault_addr, const void *esp);
+
+#endif /* vm/page.h */